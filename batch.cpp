@@ -0,0 +1,226 @@
+#include "batch.h"
+#include "huffman.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+// --- Batch Compression ---
+// `huffman batch` compresses many files in one process, so small files are
+// not dominated by process startup. Files are spread over a work-stealing
+// pool, and every worker reuses one quiet HuffmanCoding context, so its
+// tables are allocated once rather than once per file.
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// One file to compress.
+struct BatchJob {
+    fs::path input;
+    fs::path output;
+};
+
+// Totals over the files one worker compressed.
+struct BatchStats {
+    uint64_t files = 0;
+    uint64_t failed = 0;
+    uint64_t inputBytes = 0;
+    uint64_t outputBytes = 0;
+    CodingStats coding;
+};
+
+// --- Work-Stealing Queue ---
+// The jobs dealt to one worker. The owner takes them from the front, in
+// listing order; an idle worker steals from the back, taking the work the
+// owner would have reached last. Each pop is one short critical section, so
+// the lock is nearly always uncontended.
+class WorkQueue {
+public:
+    void push(size_t job) { jobs.push_back(job); }
+
+    bool pop(size_t& job) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (jobs.empty()) return false;
+        job = jobs.front();
+        jobs.pop_front();
+        return true;
+    }
+
+    bool steal(size_t& job) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (jobs.empty()) return false;
+        job = jobs.back();
+        jobs.pop_back();
+        return true;
+    }
+
+private:
+    std::mutex mutex;
+    std::deque<size_t> jobs;
+};
+
+// The output path for `input`, found at `relative` below the source.
+fs::path outputPathFor(const fs::path& outputDirectory, const fs::path& relative) {
+    fs::path output = outputDirectory / relative.relative_path();
+    output += ".huf";
+    return output;
+}
+
+// Lists every regular file below `directory`, skipping `outputDirectory` if
+// it lies inside, so earlier output is not compressed again.
+bool collectDirectory(const fs::path& directory, const fs::path& outputDirectory, std::vector<BatchJob>& jobs) {
+    std::error_code error;
+    fs::path skip = fs::weakly_canonical(outputDirectory, error);
+    fs::recursive_directory_iterator it(directory, fs::directory_options::skip_permission_denied, error);
+    if (error) {
+        std::cerr << "Error: Could not read directory: " << directory.string() << std::endl;
+        return false;
+    }
+    for (; it != fs::recursive_directory_iterator(); it.increment(error)) {
+        if (error) {
+            std::cerr << "Error: Could not read directory: " << directory.string() << std::endl;
+            return false;
+        }
+        if (it->is_directory(error) && fs::weakly_canonical(it->path(), error) == skip) {
+            it.disable_recursion_pending();
+            continue;
+        }
+        if (!it->is_regular_file(error)) continue;
+        jobs.push_back({it->path(), outputPathFor(outputDirectory, fs::relative(it->path(), directory, error))});
+    }
+    return true;
+}
+
+// Reads a manifest: one input path per line, optionally followed by a tab
+// and the output path. Relative output paths are taken from the output
+// directory; empty lines are skipped.
+bool collectManifest(std::istream& manifest, const fs::path& outputDirectory, std::vector<BatchJob>& jobs) {
+    for (std::string line; std::getline(manifest, line);) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos) {
+            jobs.push_back({line, outputPathFor(outputDirectory, line)});
+        } else {
+            jobs.push_back({line.substr(0, tab), outputDirectory / line.substr(tab + 1)});
+        }
+    }
+    return !manifest.bad();
+}
+
+// Compresses the jobs of queue `self`, then steals from the others until
+// every queue is empty.
+BatchStats runWorker(size_t self, std::vector<WorkQueue>& queues, const std::vector<BatchJob>& jobs,
+                     const CompressionOptions& options) {
+    HuffmanCoding coder;
+    coder.setQuiet(true);
+    BatchStats stats;
+    size_t job;
+    for (;;) {
+        bool found = queues[self].pop(job);
+        for (size_t i = 1; !found && i < queues.size(); ++i) {
+            found = queues[(self + i) % queues.size()].steal(job);
+        }
+        if (!found) break;
+
+        std::error_code error;
+        uint64_t inputSize = fs::file_size(jobs[job].input, error);
+        if (error || !coder.compress(jobs[job].input.string(), jobs[job].output.string(), options)) {
+            if (error) {
+                std::cerr << "Error: Could not open input file: " << jobs[job].input.string() << std::endl;
+            }
+            stats.failed++;
+            continue;
+        }
+        stats.files++;
+        stats.inputBytes += inputSize;
+        stats.outputBytes += fs::file_size(jobs[job].output, error);
+    }
+    stats.coding = coder.stats();
+    return stats;
+}
+
+} // namespace
+
+int runBatch(const BatchOptions& batch, const CompressionOptions& options, CodingStats& codingStats) {
+    std::vector<BatchJob> jobs;
+    fs::path outputDirectory = batch.outputDirectory;
+    std::error_code error;
+    if (batch.source != "-" && fs::is_directory(batch.source, error)) {
+        if (!collectDirectory(batch.source, outputDirectory, jobs)) return 1;
+    } else if (batch.source == "-") {
+        if (!collectManifest(std::cin, outputDirectory, jobs)) return 1;
+    } else {
+        std::ifstream manifest(batch.source);
+        if (!manifest.is_open() || !collectManifest(manifest, outputDirectory, jobs)) {
+            std::cerr << "Error: Could not read manifest: " << batch.source << std::endl;
+            return 1;
+        }
+    }
+
+    // Create the output tree up front, so workers never race on it.
+    std::set<fs::path> directories;
+    for (const BatchJob& job : jobs) {
+        directories.insert(job.output.parent_path());
+    }
+    for (const fs::path& directory : directories) {
+        if (!directory.empty() && !fs::create_directories(directory, error) && error) {
+            std::cerr << "Error: Could not create output directory: " << directory.string() << std::endl;
+            return 1;
+        }
+    }
+
+    // The pool supplies the parallelism; each file is coded on one thread.
+    unsigned threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    threads = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threads, jobs.size())));
+    CompressionOptions fileOptions = options;
+    fileOptions.threads = 1;
+
+    std::vector<WorkQueue> queues(threads);
+    for (size_t job = 0; job < jobs.size(); ++job) {
+        queues[job % threads].push(job);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<BatchStats> results(threads);
+    std::vector<std::thread> pool;
+    for (unsigned worker = 1; worker < threads; ++worker) {
+        pool.emplace_back([&, worker] { results[worker] = runWorker(worker, queues, jobs, fileOptions); });
+    }
+    results[0] = runWorker(0, queues, jobs, fileOptions);
+    for (std::thread& thread : pool) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    BatchStats total;
+    for (const BatchStats& stats : results) {
+        total.files += stats.files;
+        total.failed += stats.failed;
+        total.inputBytes += stats.inputBytes;
+        total.outputBytes += stats.outputBytes;
+        codingStats += stats.coding;
+    }
+    double seconds = std::max(elapsed.count(), 1e-9);
+    double ratio = total.inputBytes ? 100.0 * total.outputBytes / total.inputBytes : 0.0;
+    std::cout << std::fixed << std::setprecision(1) << "Compressed " << total.files << " files ("
+              << total.inputBytes / 1048576.0 << " MiB -> " << total.outputBytes / 1048576.0 << " MiB, " << ratio
+              << "%) in " << std::setprecision(2) << seconds << " s on " << threads << " thread(s): "
+              << std::setprecision(1) << total.inputBytes / 1048576.0 / seconds << " MiB/s, "
+              << total.files / seconds << " files/s." << std::endl;
+    if (total.failed) {
+        std::cerr << "Error: " << total.failed << " file(s) could not be compressed." << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <string>
+
+#include "huffman.h"
+
+// --- Batch Compression ---
+// Settings of the `huffman batch` command.
+struct BatchOptions {
+    // A directory to compress recursively, or a manifest file ("-" for stdin)
+    // listing one input per line, optionally followed by a tab and its output.
+    std::string source;
+    // Where the compressed files go: each input's path relative to the
+    // source (or as listed in the manifest) with ".huf" appended.
+    std::string outputDirectory;
+};
+
+// Runs the batch command, adding every worker's statistics to `stats`.
+// Returns the process exit code: non-zero if any file fails to compress.
+int runBatch(const BatchOptions& batch, const CompressionOptions& options, CodingStats& stats);
+
+#endif // BATCH_H
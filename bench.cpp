@@ -0,0 +1,246 @@
+#include "bench.h"
+#include "corpus.h"
+#include "huffman.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#define BENCH_HAVE_RUSAGE 1
+#endif
+
+// --- Benchmark ---
+// `huffman bench` compresses and decompresses a generated corpus (plus any
+// files given on the command line) in quiet mode, so progress output does not
+// distort the timings, and checks that every case round-trips.
+
+// Peak resident set size of this process so far, in KiB (0 where unknown).
+static long peakRssKiB() {
+#ifdef BENCH_HAVE_RUSAGE
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+static bool sameFileContents(const std::string& path, const std::vector<unsigned char>& expected) {
+    std::ifstream file(path, std::ios::binary);
+    std::vector<unsigned char> actual((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return actual == expected;
+}
+
+// Escapes a string for use inside a JSON string literal.
+static std::string jsonEscape(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char code[8];
+            std::snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned char>(c));
+            escaped += code;
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+// Measurements for one corpus: best-of-N wall times, the phase breakdown of
+// the fastest compress and decompress runs, and the peak RSS afterwards.
+struct BenchResult {
+    std::string name;
+    uint64_t bytes = 0;
+    uint64_t compressedBytes = 0;
+    double compressSeconds = 0;
+    double decompressSeconds = 0;
+    PhaseTimes compressPhases{};
+    PhaseTimes decompressPhases{};
+    long peakRss = 0;
+    bool roundTrip = false;
+};
+
+static double megabytesPerSecond(uint64_t bytes, double seconds) {
+    return seconds > 0 ? bytes / seconds / 1e6 : 0;
+}
+
+static double compressionRatio(const BenchResult& result) {
+    return result.compressedBytes ? double(result.bytes) / result.compressedBytes : 0;
+}
+
+// Phases each direction goes through, in the order they run. Decompression
+// rebuilds the tree only for original-format input; checksums are only
+// computed with --checksum.
+static const Phase kCompressPhases[] = {kPhaseFrequencyTable, kPhaseTree, kPhaseCodes,
+                                        kPhaseHeader, kPhaseData, kPhaseChecksum};
+static const Phase kDecompressPhases[] = {kPhaseHeader, kPhaseTree, kPhaseDecodeTables, kPhaseDecode,
+                                          kPhaseChecksum};
+
+static void printBenchText(const std::vector<BenchResult>& results) {
+    std::cout << std::left << std::setw(16) << "corpus" << std::right << std::setw(12) << "bytes"
+              << std::setw(12) << "compressed" << std::setw(8) << "ratio" << std::setw(12) << "comp MB/s"
+              << std::setw(13) << "decomp MB/s" << std::setw(14) << "peak RSS KiB" << "  round trip" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+    for (const BenchResult& result : results) {
+        std::cout << std::left << std::setw(16) << result.name << std::right << std::setw(12) << result.bytes
+                  << std::setw(12) << result.compressedBytes << std::setw(8) << compressionRatio(result)
+                  << std::setw(12) << megabytesPerSecond(result.bytes, result.compressSeconds)
+                  << std::setw(13) << megabytesPerSecond(result.bytes, result.decompressSeconds)
+                  << std::setw(14) << result.peakRss << "  " << (result.roundTrip ? "ok" : "FAILED") << std::endl;
+    }
+
+    std::cout << std::endl << std::left << std::setw(16) << "phase ms" << std::right;
+    for (Phase phase : kCompressPhases) std::cout << std::setw(9) << kPhaseNames[phase];
+    std::cout << "  |";
+    for (Phase phase : kDecompressPhases) std::cout << std::setw(14) << kPhaseNames[phase];
+    std::cout << std::endl << std::setprecision(3);
+    for (const BenchResult& result : results) {
+        std::cout << std::left << std::setw(16) << result.name << std::right;
+        for (Phase phase : kCompressPhases) std::cout << std::setw(9) << result.compressPhases[phase] * 1e3;
+        std::cout << "  |";
+        for (Phase phase : kDecompressPhases) std::cout << std::setw(14) << result.decompressPhases[phase] * 1e3;
+        std::cout << std::endl;
+    }
+}
+
+static void printPhasesJson(const char* key, const PhaseTimes& times, const Phase* phases, size_t count) {
+    std::cout << "\"" << key << "\": {";
+    for (size_t i = 0; i < count; ++i) {
+        std::cout << (i ? ", " : "") << "\"" << kPhaseNames[phases[i]] << "\": " << times[phases[i]] * 1e3;
+    }
+    std::cout << "}";
+}
+
+static void printBenchJson(const std::vector<BenchResult>& results, const BenchOptions& bench,
+                           const CompressionOptions& options) {
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "{\n  \"options\": {\"canonical\": " << (options.canonical ? "true" : "false")
+              << ", \"block_size\": " << options.blockSize
+              << ", \"shared_table\": " << (options.sharedTable ? "true" : "false")
+              << ", \"max_code_length\": " << options.maxCodeLength << ", \"streams\": " << options.streams
+              << ", \"threads\": " << (options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency())) << ", \"repeat\": " << bench.repeat
+              << ", \"direct_io\": " << (options.output.directIo ? "true" : "false")
+              << ", \"io_uring\": " << (options.output.ioUring ? "true" : "false")
+              << ", \"checksum\": " << (options.checksum ? "true" : "false")
+              << ", \"context_model\": " << (options.contextModel ? "true" : "false")
+              << ", \"corpus_size\": " << bench.size << "},\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& result = results[i];
+        std::cout << (i ? "," : "") << "\n    {\"corpus\": \"" << jsonEscape(result.name) << "\""
+                  << ", \"bytes\": " << result.bytes << ", \"compressed_bytes\": " << result.compressedBytes
+                  << ", \"ratio\": " << compressionRatio(result)
+                  << ", \"compress_mb_s\": " << megabytesPerSecond(result.bytes, result.compressSeconds)
+                  << ", \"decompress_mb_s\": " << megabytesPerSecond(result.bytes, result.decompressSeconds)
+                  << ", \"peak_rss_kib\": " << result.peakRss
+                  << ", \"round_trip\": " << (result.roundTrip ? "true" : "false") << ", ";
+        printPhasesJson("compress_phases_ms", result.compressPhases, kCompressPhases, std::size(kCompressPhases));
+        std::cout << ", ";
+        printPhasesJson("decompress_phases_ms", result.decompressPhases, kDecompressPhases,
+                        std::size(kDecompressPhases));
+        std::cout << "}";
+    }
+    std::cout << "\n  ]\n}" << std::endl;
+}
+
+// Runs one case through compress and decompress `repeat` times, keeping the
+// fastest run of each.
+static BenchResult benchCase(const std::string& name, const std::vector<unsigned char>& data,
+                             const std::filesystem::path& workDir, const BenchOptions& bench,
+                             const CompressionOptions& options, const DecompressionOptions& decompressOptions) {
+    BenchResult result;
+    result.name = name;
+    result.bytes = data.size();
+    std::string inputPath = (workDir / "input").string();
+    std::string compressedPath = (workDir / "input.huf").string();
+    std::string outputPath = (workDir / "output").string();
+    {
+        std::ofstream input(inputPath, std::ios::binary);
+        input.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    }
+
+    HuffmanCoding coder;
+    coder.setQuiet(true);
+    result.compressSeconds = result.decompressSeconds = 1e30;
+    for (unsigned run = 0; run < bench.repeat; ++run) {
+        coder.resetPhaseTimes();
+        auto start = std::chrono::steady_clock::now();
+        coder.compress(inputPath, compressedPath, options);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (elapsed.count() < result.compressSeconds) {
+            result.compressSeconds = elapsed.count();
+            result.compressPhases = coder.phaseTimes();
+        }
+
+        coder.resetPhaseTimes();
+        start = std::chrono::steady_clock::now();
+        coder.decompress(compressedPath, outputPath, decompressOptions);
+        elapsed = std::chrono::steady_clock::now() - start;
+        if (elapsed.count() < result.decompressSeconds) {
+            result.decompressSeconds = elapsed.count();
+            result.decompressPhases = coder.phaseTimes();
+        }
+    }
+    std::error_code error;
+    result.compressedBytes = std::filesystem::file_size(compressedPath, error);
+    result.roundTrip = !error && sameFileContents(outputPath, data);
+    result.peakRss = peakRssKiB();
+    return result;
+}
+
+int runBench(const BenchOptions& bench, const CompressionOptions& options,
+                    const DecompressionOptions& decompressOptions) {
+    std::error_code error;
+    std::filesystem::path workDir = std::filesystem::temp_directory_path(error) /
+        ("huffman-bench-" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()));
+    if (error || !std::filesystem::create_directories(workDir, error)) {
+        std::cerr << "Error: Could not create a benchmark directory." << std::endl;
+        return 1;
+    }
+
+    std::vector<BenchResult> results;
+    std::vector<unsigned char> data;
+    for (const std::string& kind : bench.corpora) {
+        if (!makeCorpus(kind, bench.size, data)) {
+            std::cerr << "Error: Unknown corpus '" << kind << "'" << std::endl;
+            std::filesystem::remove_all(workDir, error);
+            return 1;
+        }
+        results.push_back(benchCase(kind, data, workDir, bench, options, decompressOptions));
+    }
+    for (const std::string& path : bench.files) {
+        std::ifstream input(path, std::ios::binary);
+        if (!input.is_open()) {
+            std::cerr << "Error: Could not open input file: " << path << std::endl;
+            std::filesystem::remove_all(workDir, error);
+            return 1;
+        }
+        data.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+        results.push_back(benchCase(path, data, workDir, bench, options, decompressOptions));
+    }
+    std::filesystem::remove_all(workDir, error);
+
+    if (bench.json) {
+        printBenchJson(results, bench, options);
+    } else {
+        printBenchText(results);
+    }
+    for (const BenchResult& result : results) {
+        if (!result.roundTrip) return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "huffman.h"
+
+// --- Benchmark ---
+// Settings of the `huffman bench` command.
+struct BenchOptions {
+    std::vector<std::string> corpora = {"text", "binary", "random", "single", "empty"};
+    std::vector<std::string> files;
+    size_t size = size_t(8) << 20;
+    unsigned repeat = 3;
+    bool json = false;
+};
+
+// Runs the bench command. Returns the process exit code: non-zero if any
+// case fails to round-trip.
+int runBench(const BenchOptions& bench, const CompressionOptions& options,
+             const DecompressionOptions& decompressOptions);
+
+#endif // BENCH_H
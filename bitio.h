@@ -0,0 +1,150 @@
+#ifndef BITIO_H
+#define BITIO_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <vector>
+
+// --- Bit Writer ---
+// Packs MSB-first codes into a byte buffer. Codes are shifted into a 64-bit
+// accumulator, and whenever it fills, all 8 bytes are stored at once, so there
+// is no per-bit branch and no per-byte stream call. The buffer grows in large
+// steps; drain() hands the finished bytes to a stream and reuses the buffer.
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<unsigned char>& buffer) : buffer(buffer), pos(buffer.size()) {}
+
+    // Appends the low `length` bits of `bits` (0 <= length <= 64); any higher
+    // bits of `bits` must be zero.
+    void write(uint64_t bits, int length) {
+        int space = 64 - used;
+        if (length < space) {
+            accumulator |= bits << (space - length);
+            used += length;
+            return;
+        }
+        int rest = length - space;
+        accumulator |= bits >> rest;
+        storeWord(accumulator);
+        accumulator = rest ? bits << (64 - rest) : 0;
+        used = rest;
+        bitsFlushed += 64;
+    }
+
+    // Total number of bits written so far, including those still in the accumulator.
+    uint64_t bitCount() const { return bitsFlushed + static_cast<uint64_t>(used); }
+
+    // Writes out the bits still in the accumulator, padding the last byte with
+    // zeros, and trims the buffer to the bytes actually written.
+    void finish() {
+        for (int shift = 56; used > 0; shift -= 8, used -= 8) {
+            reserve(1);
+            buffer[pos++] = static_cast<unsigned char>(accumulator >> shift);
+            bitsFlushed += static_cast<uint64_t>(used < 8 ? used : 8);
+        }
+        used = 0;
+        accumulator = 0;
+        buffer.resize(pos);
+    }
+
+    // Number of complete bytes waiting in the buffer.
+    size_t pendingBytes() const { return pos; }
+
+    // Writes the complete bytes to `output` and empties the buffer. Bits still
+    // in the accumulator stay there.
+    void drain(std::ostream& output) {
+        output.write(reinterpret_cast<const char*>(buffer.data()), static_cast<std::streamsize>(pos));
+        pos = 0;
+    }
+
+private:
+    std::vector<unsigned char>& buffer;
+    size_t pos;
+    uint64_t accumulator = 0;
+    int used = 0;
+    uint64_t bitsFlushed = 0;
+
+    void reserve(size_t bytes) {
+        if (pos + bytes > buffer.size()) {
+            buffer.resize(std::max(buffer.size() * 2, pos + bytes + 4096));
+        }
+    }
+
+    void storeWord(uint64_t word) {
+        reserve(8);
+        unsigned char bytes[8];
+        for (int i = 0; i < 8; ++i) {
+            bytes[i] = static_cast<unsigned char>(word >> (56 - 8 * i));
+        }
+        std::memcpy(buffer.data() + pos, bytes, 8);
+        pos += 8;
+    }
+};
+
+// --- Bit Reader ---
+// Reads MSB-first codes from a byte buffer through a 64-bit accumulator.
+// refill() tops the accumulator up with a single 8-byte load while at least 8
+// input bytes remain, so it always holds at least 57 bits until the input runs
+// out. Bits past the end of the input read as zero, but available() counts
+// only real ones.
+class BitReader {
+public:
+    // A reader of no input, for arrays that are assigned real readers later.
+    BitReader() : BitReader(nullptr, 0) {}
+
+    BitReader(const unsigned char* data, size_t size, uint64_t bitPosition = 0)
+        : data(data), size(size), bytePos(static_cast<size_t>(bitPosition >> 3)) {
+        refill();
+        int skip = static_cast<int>(bitPosition & 7);
+        if (skip > bitCount) skip = bitCount;
+        consume(skip);
+    }
+
+    void refill() {
+        if (bytePos + 8 <= size) {
+            uint64_t word = 0;
+            for (int i = 0; i < 8; ++i) {
+                word = (word << 8) | data[bytePos + i];
+            }
+            // Bits beyond bitCount are either zero or already the next input bits,
+            // so OR-ing the whole word in is safe; only whole bytes are counted.
+            accumulator |= word >> bitCount;
+            int taken = (63 - bitCount) >> 3;
+            bytePos += static_cast<size_t>(taken);
+            bitCount += taken * 8;
+            return;
+        }
+        while (bitCount <= 56 && bytePos < size) {
+            accumulator |= uint64_t(data[bytePos++]) << (56 - bitCount);
+            bitCount += 8;
+        }
+    }
+
+    // The next `length` bits (1 <= length <= 64) without consuming them.
+    uint64_t peek(int length) const { return accumulator >> (64 - length); }
+
+    // The next bit without consuming it.
+    unsigned peekBit() const { return static_cast<unsigned>(accumulator >> 63); }
+
+    void consume(int length) {
+        accumulator = length < 64 ? accumulator << length : 0;
+        bitCount -= length;
+    }
+
+    // Number of real input bits currently held in the accumulator.
+    int available() const { return bitCount; }
+
+    // Bit offset of the next unread bit from the start of the buffer.
+    uint64_t position() const { return uint64_t(bytePos) * 8 - static_cast<uint64_t>(bitCount); }
+
+private:
+    const unsigned char* data;
+    size_t size;
+    size_t bytePos;
+    uint64_t accumulator = 0;
+    int bitCount = 0;
+};
+
+#endif // BITIO_H
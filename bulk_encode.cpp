@@ -0,0 +1,60 @@
+#include "bulk_encode.h"
+
+#include <cstring>
+
+namespace {
+
+// --- Bit Packing ---
+// The bits not yet stored are the low `used` bits of `bits`; a flush stores
+// them as one big-endian word and advances past the whole bytes, so fewer
+// than 8 bits are left pending afterwards. Appending at most 56 bits between
+// flushes keeps everything within the 64-bit register.
+struct PackState {
+    unsigned char* output;
+    size_t pos = 0;
+    uint64_t bits = 0;
+    int used = 0;
+
+    void put(uint64_t code, int length) {
+        bits = bits << length | code;
+        used += length;
+    }
+
+    // Requires at least one pending bit.
+    void flush() {
+        uint64_t word = bits << (64 - used);
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        std::memcpy(output + pos, &word, 8);
+        pos += static_cast<size_t>(used >> 3);
+        used &= 7;
+    }
+};
+
+// Appends the last few codes one at a time and returns the total bit count.
+// The final flush leaves the partial last byte in place, padded with zeros.
+uint64_t finish(PackState& state, const unsigned char* data, size_t size, const uint32_t table[256]) {
+    for (size_t i = 0; i < size; ++i) {
+        uint32_t entry = table[data[i]];
+        state.put(entry & 0xFF, static_cast<int>(entry >> 8));
+        state.flush();
+    }
+    return uint64_t(state.pos) * 8 + static_cast<uint64_t>(state.used);
+}
+
+} // namespace
+
+// Seven codes (at most 56 bits) per flush.
+uint64_t bulkEncode(const unsigned char* data, size_t size, const uint32_t table[256], unsigned char* output) {
+    PackState state{output};
+    size_t i = 0;
+    for (; i + 7 <= size; i += 7) {
+        for (int j = 0; j < 7; ++j) {
+            uint32_t entry = table[data[i + j]];
+            state.put(entry & 0xFF, static_cast<int>(entry >> 8));
+        }
+        state.flush();
+    }
+    return finish(state, data + i, size - i, table);
+}
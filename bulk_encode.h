@@ -0,0 +1,34 @@
+#ifndef BULK_ENCODE_H
+#define BULK_ENCODE_H
+
+#include <cstddef>
+#include <cstdint>
+
+// --- Bulk Encoding ---
+// Appending one code at a time to a bit accumulator is a serial chain: every
+// code's position depends on the lengths of all the codes before it. When no
+// code is longer than kBulkMaxCodeLength bits, a whole group of codes fits
+// one register append: seven codes go into the accumulator per store. This is
+// plain scalar code; the per-byte table lookups dominate, so merging codes in
+// vector registers measured no faster.
+
+// Longest code bulkEncode() accepts.
+static constexpr int kBulkMaxCodeLength = 8;
+
+// Bytes the output buffer must have beyond the packed codes, since the
+// encoder stores whole 8-byte words.
+static constexpr size_t kBulkOutputSlack = 8;
+
+// A table entry: the code of a byte value, right-aligned in the low 8 bits,
+// with its length (1 to kBulkMaxCodeLength) in the bits above.
+inline uint32_t bulkCodeEntry(uint64_t bits, int length) {
+    return static_cast<uint32_t>(bits) | static_cast<uint32_t>(length) << 8;
+}
+
+// Writes the codes of `data`, looked up in `table`, to `output` as an
+// MSB-first bitstream with the last byte padded with zeros, and returns the
+// number of bits. `output` must have room for `size` + kBulkOutputSlack
+// bytes, and every byte in `data` needs an entry.
+uint64_t bulkEncode(const unsigned char* data, size_t size, const uint32_t table[256], unsigned char* output);
+
+#endif // BULK_ENCODE_H
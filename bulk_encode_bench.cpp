@@ -0,0 +1,78 @@
+// --- Bulk Encode Microbenchmark ---
+// Measures single-core throughput of the bulk encoder on a few
+// characteristic inputs, and checks it against a plain bit-by-bit encoder.
+//
+// Usage: bulk_encode_bench [size_in_MiB]
+
+#include "bulk_encode.h"
+#include "corpus.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// Gives every byte of `data` a code of about -log2(p) bits, between 1 and
+// kBulkMaxCodeLength. The codes need not form a prefix code to be packed.
+static void makeTable(const std::vector<unsigned char>& data, uint32_t table[256]) {
+    std::vector<double> counts(256, 0);
+    for (unsigned char byte : data) counts[byte]++;
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        double bits = counts[symbol] ? std::ceil(-std::log2(counts[symbol] / data.size())) : kBulkMaxCodeLength;
+        int length = std::clamp(static_cast<int>(bits), 1, kBulkMaxCodeLength);
+        table[symbol] = bulkCodeEntry(uint64_t(symbol * 2654435761u) & ((1u << length) - 1), length);
+    }
+}
+
+// The reference: appends every code one bit at a time.
+static std::vector<unsigned char> encodeBitwise(const std::vector<unsigned char>& data, const uint32_t table[256]) {
+    std::vector<unsigned char> output;
+    uint64_t bit = 0;
+    for (unsigned char byte : data) {
+        int length = static_cast<int>(table[byte] >> 8);
+        for (int i = length - 1; i >= 0; --i, ++bit) {
+            if (bit % 8 == 0) output.push_back(0);
+            output.back() |= static_cast<unsigned char>(((table[byte] >> i) & 1) << (7 - bit % 8));
+        }
+    }
+    return output;
+}
+
+int main(int argc, char* argv[]) {
+    size_t sizeMiB = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 64;
+    if (sizeMiB == 0) {
+        std::fprintf(stderr, "Usage: bulk_encode_bench [size_in_MiB]\n");
+        return 1;
+    }
+    size_t size = sizeMiB << 20;
+    const int repetitions = 5;
+
+    std::printf("%-12s %10s\n", "input", "GB/s");
+
+    bool agree = true;
+    std::vector<unsigned char> output(size + kBulkOutputSlack);
+    std::vector<unsigned char> data;
+    for (const char* corpus : {"text", "acgt", "random"}) {
+        makeCorpus(corpus, size, data);
+        uint32_t table[256];
+        makeTable(data, table);
+        std::vector<unsigned char> reference = encodeBitwise(data, table);
+        uint64_t bits = 0;
+        double best = 1e30;
+        for (int run = 0; run < repetitions; ++run) {
+            auto start = std::chrono::steady_clock::now();
+            bits = bulkEncode(data.data(), data.size(), table, output.data());
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            best = std::min(best, elapsed.count());
+        }
+        if ((bits + 7) / 8 != reference.size() || !std::equal(reference.begin(), reference.end(), output.begin())) {
+            std::printf("Mismatch on %s\n", corpus);
+            agree = false;
+        }
+        std::printf("%-12s %10.2f\n", corpus, size / best / 1e9);
+    }
+    return agree ? 0 : 1;
+}
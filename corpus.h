@@ -0,0 +1,63 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+// --- Synthetic Corpora ---
+// Generated inputs shared by `huffman bench`, the kernel microbenchmarks and
+// the fuzz target's seeds. Every kind is deterministic for a given size.
+
+// Builds one synthetic corpus of about `size` bytes; returns false for an unknown kind.
+inline bool makeCorpus(const std::string& kind, size_t size, std::vector<unsigned char>& data) {
+    std::mt19937_64 random(42);
+    data.clear();
+    if (kind == "empty") {
+        return true;
+    }
+    if (kind == "single") {
+        data.assign(size, 'a');
+    } else if (kind == "random") {
+        data.resize(size);
+        for (auto& byte : data) byte = static_cast<unsigned char>(random());
+    } else if (kind == "text") {
+        // Log-like lines over a small vocabulary with a skewed word distribution.
+        static const char* const words[] = {
+            "the", "of", "and", "to", "in", "request", "server", "error", "user", "time",
+            "connection", "GET", "POST", "200", "404", "ms", "cache", "miss", "hit", "session",
+        };
+        std::geometric_distribution<int> pick(0.2);
+        while (data.size() < size) {
+            for (int wordCount = 0; wordCount < 12; ++wordCount) {
+                const char* word = words[std::min(pick(random), 19)];
+                data.insert(data.end(), word, word + std::strlen(word));
+                data.push_back(' ');
+            }
+            data.back() = '\n';
+        }
+        data.resize(size);
+    } else if (kind == "binary") {
+        // 32-byte records: a counter, small integers, a random hash and zero padding.
+        data.assign(size, 0);
+        for (size_t offset = 0, record = 0; offset + 32 <= size; offset += 32, ++record) {
+            for (int i = 0; i < 8; ++i) data[offset + i] = static_cast<unsigned char>(record >> (8 * i));
+            for (int i = 8; i < 16; ++i) data[offset + i] = static_cast<unsigned char>(random() % 16);
+            uint64_t hash = random();
+            for (int i = 16; i < 24; ++i) data[offset + i] = static_cast<unsigned char>(hash >> (8 * (i - 16)));
+        }
+    } else if (kind == "acgt") {
+        // Four equally likely symbols, like nucleotide data.
+        data.resize(size);
+        for (auto& byte : data) byte = static_cast<unsigned char>("ACGT"[random() % 4]);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+#endif // CORPUS_H
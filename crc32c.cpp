@@ -0,0 +1,215 @@
+#include "crc32c.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define CRC32C_X86 1
+#endif
+
+#if defined(__aarch64__)
+#include <arm_acle.h>
+#define CRC32C_ARM 1
+#if defined(__linux__)
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+#endif
+
+namespace {
+
+// The Castagnoli polynomial, bit-reversed: bit 31 is x^0.
+constexpr uint32_t kPolynomial = 0x82F63B78u;
+
+// --- Polynomial Arithmetic ---
+// A CRC register is a polynomial over GF(2). Appending n zero bytes
+// multiplies it by x^(8n) modulo the polynomial, which is what combining two
+// CRCs needs, and what lets the hardware kernels run independent chains.
+
+// Multiplies two reflected polynomials modulo kPolynomial.
+uint32_t multiplyModP(uint32_t a, uint32_t b) {
+    uint32_t product = 0;
+    for (uint32_t bit = 1u << 31; bit; bit >>= 1) {
+        if (a & bit) product ^= b;
+        b = b & 1 ? (b >> 1) ^ kPolynomial : b >> 1;
+    }
+    return product;
+}
+
+// x^(8 * bytes) modulo kPolynomial, by squaring: powers[k] is x^(2^k).
+uint32_t shiftFactor(uint64_t bytes) {
+    static const auto powers = [] {
+        struct Powers {
+            uint32_t value[64];
+        } powers;
+        powers.value[0] = 1u << 30;
+        for (int k = 1; k < 64; ++k) {
+            powers.value[k] = multiplyModP(powers.value[k - 1], powers.value[k - 1]);
+        }
+        return powers;
+    }();
+    uint32_t factor = 1u << 31;
+    for (int k = 3; bytes; bytes >>= 1, ++k) {
+        if (bytes & 1) factor = multiplyModP(powers.value[k], factor);
+    }
+    return factor;
+}
+
+// --- Scalar Kernel ---
+// Slicing-by-8: eight table lookups per 8 bytes, with no carried dependency
+// between them except through the register. Works everywhere.
+struct SliceTables {
+    uint32_t table[8][256];
+};
+
+const SliceTables& sliceTables() {
+    static const SliceTables tables = [] {
+        SliceTables tables;
+        for (uint32_t byte = 0; byte < 256; ++byte) {
+            uint32_t crc = byte;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = crc & 1 ? (crc >> 1) ^ kPolynomial : crc >> 1;
+            }
+            tables.table[0][byte] = crc;
+        }
+        for (uint32_t byte = 0; byte < 256; ++byte) {
+            for (int slice = 1; slice < 8; ++slice) {
+                uint32_t previous = tables.table[slice - 1][byte];
+                tables.table[slice][byte] = (previous >> 8) ^ tables.table[0][previous & 0xFF];
+            }
+        }
+        return tables;
+    }();
+    return tables;
+}
+
+uint32_t extendScalar(uint32_t crc, const unsigned char* data, size_t size) {
+    const auto& table = sliceTables().table;
+    crc = ~crc;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint32_t low, high;
+        std::memcpy(&low, data + i, 4);
+        std::memcpy(&high, data + i + 4, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        low = __builtin_bswap32(low);
+        high = __builtin_bswap32(high);
+#endif
+        low ^= crc;
+        crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^ table[5][(low >> 16) & 0xFF] ^
+              table[4][low >> 24] ^ table[3][high & 0xFF] ^ table[2][(high >> 8) & 0xFF] ^
+              table[1][(high >> 16) & 0xFF] ^ table[0][high >> 24];
+    }
+    for (; i < size; ++i) {
+        crc = (crc >> 8) ^ table[0][(crc ^ data[i]) & 0xFF];
+    }
+    return ~crc;
+}
+
+// --- Hardware Kernels ---
+// The CRC instruction has a latency of about three cycles but a throughput
+// of one per cycle, so large inputs are split into three stripes whose
+// chains run side by side and are then joined with shiftFactor().
+constexpr size_t kStripeSize = 4096;
+
+// Continues a raw (uncomplemented) register with the 8-byte instruction
+// `step8` and the 1-byte instruction `step1`.
+template <typename Step8, typename Step1>
+__attribute__((always_inline)) inline uint32_t extendStriped(uint32_t crc, const unsigned char* data, size_t size,
+                                                             Step8 step8, Step1 step1) {
+    static const uint32_t stripeShift = shiftFactor(kStripeSize);
+    while (size >= 3 * kStripeSize) {
+        uint32_t first = crc, second = 0, third = 0;
+        for (size_t i = 0; i < kStripeSize; i += 8) {
+            uint64_t a, b, c;
+            std::memcpy(&a, data + i, 8);
+            std::memcpy(&b, data + kStripeSize + i, 8);
+            std::memcpy(&c, data + 2 * kStripeSize + i, 8);
+            first = step8(first, a);
+            second = step8(second, b);
+            third = step8(third, c);
+        }
+        crc = multiplyModP(stripeShift, multiplyModP(stripeShift, first) ^ second) ^ third;
+        data += 3 * kStripeSize;
+        size -= 3 * kStripeSize;
+    }
+    for (; size >= 8; data += 8, size -= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, 8);
+        crc = step8(crc, word);
+    }
+    for (; size > 0; ++data, --size) {
+        crc = step1(crc, *data);
+    }
+    return crc;
+}
+
+#ifdef CRC32C_X86
+// --- SSE4.2 Kernel ---
+__attribute__((target("sse4.2")))
+uint32_t extendSse42(uint32_t crc, const unsigned char* data, size_t size) {
+    auto step8 = [](uint32_t value, uint64_t word) __attribute__((target("sse4.2"))) {
+        return static_cast<uint32_t>(_mm_crc32_u64(value, word));
+    };
+    auto step1 = [](uint32_t value, unsigned char byte) __attribute__((target("sse4.2"))) {
+        return _mm_crc32_u8(value, byte);
+    };
+    return ~extendStriped(~crc, data, size, step8, step1);
+}
+#endif
+
+#ifdef CRC32C_ARM
+// --- ARMv8 CRC Kernel ---
+__attribute__((target("+crc")))
+uint32_t extendArm(uint32_t crc, const unsigned char* data, size_t size) {
+    auto step8 = [](uint32_t value, uint64_t word) __attribute__((target("+crc"))) {
+        return __crc32cd(value, word);
+    };
+    auto step1 = [](uint32_t value, unsigned char byte) __attribute__((target("+crc"))) {
+        return __crc32cb(value, byte);
+    };
+    return ~extendStriped(~crc, data, size, step8, step1);
+}
+
+bool armHasCrc() {
+#if defined(__linux__)
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+    // Every 64-bit Apple and Windows ARM CPU implements the CRC extension.
+    return true;
+#endif
+}
+#endif
+
+} // namespace
+
+std::vector<Crc32cKernel> availableCrc32cKernels() {
+    std::vector<Crc32cKernel> kernels = {{"scalar", extendScalar}};
+#ifdef CRC32C_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        kernels.push_back({"sse4.2", extendSse42});
+    }
+#endif
+#ifdef CRC32C_ARM
+    if (armHasCrc()) {
+        kernels.push_back({"armv8", extendArm});
+    }
+#endif
+    return kernels;
+}
+
+const Crc32cKernel& selectedCrc32cKernel() {
+    static const Crc32cKernel kernel = availableCrc32cKernels().back();
+    return kernel;
+}
+
+uint32_t crc32c(uint32_t crc, const unsigned char* data, size_t size) {
+    return selectedCrc32cKernel().extend(crc, data, size);
+}
+
+uint32_t crc32cCombine(uint32_t first, uint32_t second, uint64_t secondSize) {
+    return multiplyModP(shiftFactor(secondSize), first) ^ second;
+}
@@ -0,0 +1,34 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// --- CRC32C Kernels ---
+// CRC-32C (Castagnoli), the checksum of iSCSI and ext4, which x86 (SSE4.2)
+// and ARMv8 compute with a dedicated instruction at several bytes per cycle.
+// Values follow the usual convention: the CRC of an empty message is zero,
+// and "123456789" gives 0xE3069283.
+
+// One CRC implementation. `extend` continues `crc` (the CRC of everything
+// before `data`) over `size` more bytes and returns the result.
+struct Crc32cKernel {
+    const char* name;
+    uint32_t (*extend)(uint32_t crc, const unsigned char* data, size_t size);
+};
+
+// Every kernel the running CPU supports, slowest first.
+std::vector<Crc32cKernel> availableCrc32cKernels();
+
+// The fastest kernel the running CPU supports, chosen once at first use.
+const Crc32cKernel& selectedCrc32cKernel();
+
+// Continues `crc` over `data` with the selected kernel.
+uint32_t crc32c(uint32_t crc, const unsigned char* data, size_t size);
+
+// The CRC of two messages one after the other, from the CRC of each and the
+// length of the second, without touching the data again.
+uint32_t crc32cCombine(uint32_t first, uint32_t second, uint64_t secondSize);
+
+#endif // CRC32C_H
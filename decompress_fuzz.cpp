@@ -0,0 +1,161 @@
+// --- Decompression Fuzz Target ---
+// Feeds arbitrary bytes to the decompressor, which must reject or decode
+// them without crashing or reading out of bounds. Built with clang's
+// libFuzzer (`make decompress_fuzz_libfuzzer`), the fuzzer drives
+// LLVMFuzzerTestOneInput. The plain build (`make decompress_fuzz`) has its
+// own driver instead: it runs every file given on the command line, or
+// mutates archives of every format it writes itself, and reports the
+// slowest input it rejected, since bad input should fail in microseconds.
+//
+// Usage: decompress_fuzz [iterations | file...]
+
+#include "huffman.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Drops everything written to it.
+class DiscardBuffer : public std::streambuf {
+protected:
+    int_type overflow(int_type c) override { return traits_type::not_eof(c); }
+    std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+};
+
+// Decompresses one input whole, as a range, and as a stream, which reads
+// the blocks as they arrive rather than from a mapped buffer. A table cache
+// is shared between inputs so that cached tables are exercised too. Returns
+// whether the whole input decoded.
+static bool decompressInput(const uint8_t* data, size_t size) {
+    static DecodeTableCache cache(16);
+    static HuffmanCoding streamCoder;
+    DecompressionOptions options;
+    options.threads = 1;
+    options.tableCache = &cache;
+    std::vector<unsigned char> output;
+    bool decoded = huffmanDecompress(data, size, output, options);
+    huffmanExtract(data, size, size % 97, 4096, output, options);
+    std::istringstream input(std::string(reinterpret_cast<const char*>(data), size));
+    DiscardBuffer discard;
+    std::ostream sink(&discard);
+    streamCoder.decompress(input, sink, options);
+    return decoded;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    decompressInput(data, size);
+    return 0;
+}
+
+#ifndef HUFFMAN_LIBFUZZER
+#include "corpus.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <random>
+
+// Archives of a few characteristic inputs in every format and block type.
+static std::vector<std::vector<unsigned char>> makeSeeds() {
+    std::vector<unsigned char> text, bases, single;
+    makeCorpus("text", 48 << 10, text);
+    makeCorpus("acgt", 16 << 10, bases);
+    makeCorpus("single", 8 << 10, single);
+
+    // Both formats, small and interleaved blocks, shared and capped tables,
+    // checksums, and context coding.
+    std::vector<CompressionOptions> formats(8);
+    formats[1].canonical = true;
+    formats[2].blockSize = 4096;
+    formats[3].blockSize = 4096;
+    formats[3].streams = kInterleavedStreams;
+    formats[4].blockSize = 2048;
+    formats[4].sharedTable = true;
+    formats[5].blockSize = 8192;
+    formats[5].maxCodeLength = 9;
+    formats[5].checksum = true;
+    formats[6].blockSize = 16384;
+    formats[6].contextModel = true;
+    formats[7].canonical = true;
+    formats[7].checksum = true;
+
+    std::vector<std::vector<unsigned char>> seeds;
+    for (const auto* input : {&text, &bases, &single}) {
+        for (const CompressionOptions& options : formats) {
+            std::vector<unsigned char> archive;
+            if (huffmanCompress(input->data(), input->size(), archive, options)) seeds.push_back(archive);
+        }
+    }
+    return seeds;
+}
+
+// Damages a copy of `input`: flipped bits, random bytes, large values over
+// what may be a size field, truncation, or inserted junk.
+static std::vector<unsigned char> mutate(std::vector<unsigned char> input, std::mt19937_64& random) {
+    int edits = 1 + static_cast<int>(random() % 4);
+    for (int edit = 0; edit < edits && !input.empty(); ++edit) {
+        size_t at = random() % input.size();
+        switch (random() % 5) {
+        case 0:
+            input[at] ^= static_cast<unsigned char>(1u << (random() % 8));
+            break;
+        case 1:
+            input[at] = static_cast<unsigned char>(random());
+            break;
+        case 2:
+            for (size_t i = at; i < std::min(input.size(), at + 8); ++i) input[i] = 0xFF;
+            break;
+        case 3:
+            input.resize(at);
+            break;
+        default:
+            for (int i = static_cast<int>(random() % 16); i >= 0; --i) {
+                input.insert(input.begin() + static_cast<std::ptrdiff_t>(at), static_cast<unsigned char>(random()));
+            }
+            break;
+        }
+    }
+    return input;
+}
+
+int main(int argc, char* argv[]) {
+    double slowest = 0;
+    size_t slowestSize = 0, inputs = 0, rejected = 0;
+    auto run = [&](const std::vector<unsigned char>& input) {
+        auto start = std::chrono::steady_clock::now();
+        bool decoded = decompressInput(input.data(), input.size());
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        inputs++;
+        if (decoded) return;
+        rejected++;
+        if (elapsed.count() > slowest) {
+            slowest = elapsed.count();
+            slowestSize = input.size();
+        }
+    };
+
+    if (argc > 1 && std::strtoul(argv[1], nullptr, 10) == 0) {
+        for (int i = 1; i < argc; ++i) {
+            std::ifstream file(argv[i], std::ios::binary);
+            if (!file) {
+                std::fprintf(stderr, "Error: Could not open input file: %s\n", argv[i]);
+                return 1;
+            }
+            run(std::vector<unsigned char>(std::istreambuf_iterator<char>(file), {}));
+        }
+    } else {
+        size_t iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000;
+        std::vector<std::vector<unsigned char>> seeds = makeSeeds();
+        std::mt19937_64 random(42);
+        for (const auto& seed : seeds) run(seed);
+        for (size_t i = 0; i < iterations; ++i) run(mutate(seeds[random() % seeds.size()], random));
+    }
+    std::printf("%zu inputs, %zu rejected, slowest rejection %.1f us (%zu bytes)\n", inputs, rejected, slowest * 1e6,
+                slowestSize);
+    return 0;
+}
+#endif
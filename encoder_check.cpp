@@ -0,0 +1,70 @@
+// --- Encoder Checks ---
+// Checks properties of the compressed output that a round trip alone does
+// not show. Run by `make check`; prints every failed check and exits
+// non-zero if there was one.
+//
+// Usage: encoder_check
+
+#include "corpus.h"
+#include "huffman.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool passed, const std::string& what) {
+    if (!passed) {
+        std::printf("FAILED: %s\n", what.c_str());
+        failures++;
+    }
+}
+
+// Blocks are coded on several threads, but which table a block repeats
+// must not depend on which thread finishes first, or on how many there
+// are: the output has to match the single-threaded one exactly.
+static void checkDeterministicBlocks() {
+    std::vector<unsigned char> data, archive;
+    for (const char* corpus : {"text", "binary", "acgt"}) {
+        makeCorpus(corpus, size_t(4) << 20, data);
+        CompressionOptions options;
+        options.blockSize = 64 << 10;
+        options.threads = 1;
+        std::vector<unsigned char> reference;
+        check(huffmanCompress(data.data(), data.size(), reference, options), std::string("compress ") + corpus);
+        for (unsigned threads : {2u, 3u, 4u, 4u, 8u}) {
+            options.threads = threads;
+            check(huffmanCompress(data.data(), data.size(), archive, options) && archive == reference,
+                  std::string(corpus) + " on " + std::to_string(threads) + " threads matches one thread");
+        }
+    }
+}
+
+// Decompression rejects blocks over kMaxBlockSize, so compression must never
+// write one, whether the whole input is one block or the size is given.
+static void checkBlockSizeLimit() {
+    CompressionOptions options;
+    options.canonical = true;
+    check(containerBlockSize(options, 4096) == 4096, "a small input is one block");
+    check(containerBlockSize(options, kMaxBlockSize) == kMaxBlockSize, "an input of kMaxBlockSize is one block");
+    check(containerBlockSize(options, uint64_t(kMaxBlockSize) + 4096) == kMaxBlockSize,
+          "an input over kMaxBlockSize is split");
+    options.blockSize = 64 << 10;
+    check(containerBlockSize(options, uint64_t(8) << 30) == options.blockSize, "--block-size is kept");
+    options.blockSize = size_t(kMaxBlockSize) * 2;
+    check(containerBlockSize(options, uint64_t(8) << 30) == kMaxBlockSize, "--block-size is capped");
+
+    std::vector<unsigned char> data, archive, restored;
+    makeCorpus("text", 256 << 10, data);
+    check(huffmanCompress(data.data(), data.size(), archive, options) &&
+              huffmanDecompress(archive.data(), archive.size(), restored) && restored == data,
+          "an oversized --block-size round-trips");
+}
+
+int main() {
+    checkBlockSizeLimit();
+    checkDeterministicBlocks();
+    if (failures == 0) std::printf("All encoder checks passed.\n");
+    return failures ? 1 : 0;
+}
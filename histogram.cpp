@@ -0,0 +1,53 @@
+#include "histogram.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Sub-table counters are 32 bits wide, so input is counted in chunks small
+// enough that no merged total can overflow, and each chunk is added into the
+// 64-bit result.
+constexpr size_t kChunkSize = size_t(1) << 30;
+
+// Interleaved sub-tables each chunk is counted into.
+constexpr int kSubTables = 8;
+
+// Counts one chunk into the sub-tables, 8 bytes per load.
+inline void countChunk(const unsigned char* data, size_t size, uint32_t (*tables)[256]) {
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        uint64_t first, second;
+        std::memcpy(&first, data + i, 8);
+        std::memcpy(&second, data + i + 8, 8);
+        for (int byte = 0; byte < 8; ++byte) {
+            tables[byte % kSubTables][(first >> (8 * byte)) & 0xFF]++;
+        }
+        for (int byte = 0; byte < 8; ++byte) {
+            tables[(byte + 8) % kSubTables][(second >> (8 * byte)) & 0xFF]++;
+        }
+    }
+    for (; i < size; ++i) {
+        tables[0][data[i]]++;
+    }
+}
+
+} // namespace
+
+// The sub-tables are merged with plain integer adds, which the compiler
+// vectorises where it can.
+void countFrequencies(const unsigned char* data, size_t size, uint64_t counts[256]) {
+    std::fill(counts, counts + 256, 0);
+    alignas(64) uint32_t tables[kSubTables][256];
+    for (size_t offset = 0; offset < size; offset += kChunkSize) {
+        std::memset(tables, 0, sizeof(tables));
+        countChunk(data + offset, std::min(kChunkSize, size - offset), tables);
+        for (int symbol = 0; symbol < 256; ++symbol) {
+            uint32_t sum = 0;
+            for (int table = 0; table < kSubTables; ++table) {
+                sum += tables[table][symbol];
+            }
+            counts[symbol] += sum;
+        }
+    }
+}
@@ -0,0 +1,19 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <cstddef>
+#include <cstdint>
+
+// --- Byte Histogram ---
+// Counting every byte into a single table stalls on store-to-load forwarding
+// whenever the same byte value repeats (zero padding, runs of spaces), since
+// each increment depends on the previous one. The counter spreads
+// consecutive bytes over eight interleaved sub-tables so repeated values
+// update independent counters, and then adds the sub-tables together. It is
+// plain scalar code: variants that merged the sub-tables with SSE2, AVX2 or
+// NEON adds measured no faster.
+
+// Overwrites `counts` with the number of occurrences of every byte value in `data`.
+void countFrequencies(const unsigned char* data, size_t size, uint64_t counts[256]);
+
+#endif // HISTOGRAM_H
@@ -0,0 +1,49 @@
+// --- Histogram Microbenchmark ---
+// Measures single-core throughput of the byte histogram on a few
+// characteristic inputs, and checks it against a plain one-table count.
+//
+// Usage: histogram_bench [size_in_MiB]
+
+#include "corpus.h"
+#include "histogram.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+int main(int argc, char* argv[]) {
+    size_t sizeMiB = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 64;
+    if (sizeMiB == 0) {
+        std::fprintf(stderr, "Usage: histogram_bench [size_in_MiB]\n");
+        return 1;
+    }
+    size_t size = sizeMiB << 20;
+    const int repetitions = 5;
+
+    std::printf("%-12s %10s\n", "input", "GB/s");
+
+    bool agree = true;
+    std::vector<unsigned char> data;
+    for (const char* corpus : {"random", "binary", "text"}) {
+        makeCorpus(corpus, size, data);
+        uint64_t reference[256] = {};
+        for (unsigned char byte : data) reference[byte]++;
+        uint64_t counts[256];
+        double best = 1e30;
+        for (int run = 0; run < repetitions; ++run) {
+            auto start = std::chrono::steady_clock::now();
+            countFrequencies(data.data(), data.size(), counts);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            best = std::min(best, elapsed.count());
+        }
+        if (!std::equal(counts, counts + 256, reference)) {
+            std::printf("Mismatch on %s\n", corpus);
+            agree = false;
+        }
+        std::printf("%-12s %10.2f\n", corpus, size / best / 1e9);
+    }
+    return agree ? 0 : 1;
+}
@@ -1,334 +1,4259 @@
-#include <iostream>
-#include <fstream>
-#include <string>
-#include <vector>
-#include <queue>
-#include <map>
-#include <memory>
-
-// --- Huffman Tree Node ---
-// Represents a node in the Huffman Tree.
-// It can be a leaf node (with a character) or an internal node.
-struct HuffmanNode {
-    char data;
-    unsigned frequency;
-    std::shared_ptr<HuffmanNode> left, right;
-
-    HuffmanNode(char data, unsigned frequency) : data(data), frequency(frequency), left(nullptr), right(nullptr) {}
-};
-
-// --- Comparison Functor for Priority Queue ---
-// A comparison structure to order nodes in the min-priority queue.
-// The node with the lowest frequency has the highest priority.
-struct CompareNodes {
-    bool operator()(const std::shared_ptr<HuffmanNode>& l, const std::shared_ptr<HuffmanNode>& r) const {
-        return l->frequency > r->frequency;
-    }
-};
-
-// --- Huffman Coding Class ---
-// Encapsulates the entire compression and decompression logic.
-class HuffmanCoding {
-public:
-    // Main function to compress a file.
-    void compress(const std::string& inputFilePath, const std::string& outputFilePath);
-
-    // Main function to decompress a file.
-    void decompress(const std::string& inputFilePath, const std::string& outputFilePath);
-
-private:
-    std::map<char, unsigned> frequencyMap;
-    std::map<char, std::string> huffmanCodes;
-    std::shared_ptr<HuffmanNode> treeRoot;
-
-    // Helper methods for compression
-    void buildFrequencyTable(std::ifstream& inputFile);
-    void buildHuffmanTree();
-    void generateCodes(const std::shared_ptr<HuffmanNode>& node, const std::string& code);
-    void writeHeader(std::ofstream& outputFile);
-    void writeCompressedData(std::ifstream& inputFile, std::ofstream& outputFile);
-
-    // Helper methods for decompression
-    void readHeader(std::ifstream& inputFile);
-    void decodeData(std::ifstream& inputFile, std::ofstream& outputFile);
-};
-
-// --- Compression Implementation ---
-
-void HuffmanCoding::buildFrequencyTable(std::ifstream& inputFile) {
-    char character;
-    frequencyMap.clear();
-    // Reset stream to the beginning to read from the start.
-    inputFile.clear();
-    inputFile.seekg(0, std::ios::beg);
-    
-    while (inputFile.get(character)) {
-        frequencyMap[character]++;
-    }
-}
-
-void HuffmanCoding::buildHuffmanTree() {
-    std::priority_queue<std::shared_ptr<HuffmanNode>, std::vector<std::shared_ptr<HuffmanNode>>, CompareNodes> pq;
-
-    // Create a leaf node for each character and add it to the priority queue.
-    for (auto const& [key, val] : frequencyMap) {
-        pq.push(std::make_shared<HuffmanNode>(key, val));
-    }
-
-    // Edge Case: If the file is empty, the priority queue will be empty.
-    if (pq.empty()) {
-        treeRoot = nullptr;
-        return;
-    }
-
-    // Edge Case: If there is only one unique character in the file.
-    // The tree must have at least two levels to be traversable.
-    // We create a dummy parent node to ensure codes can be generated and decoded.
-    if (pq.size() == 1) {
-        auto singleNode = pq.top();
-        pq.pop();
-        auto dummyParent = std::make_shared<HuffmanNode>('$', singleNode->frequency);
-        dummyParent->left = singleNode;
-        pq.push(dummyParent);
-    }
-
-    // Main loop to build the tree.
-    // Continues until only one node remains in the queue, which is the root.
-    while (pq.size() > 1) {
-        // Extract the two nodes with the lowest frequency.
-        auto left = pq.top();
-        pq.pop();
-        auto right = pq.top();
-        pq.pop();
-
-        // Create a new internal node with these two nodes as children.
-        // The frequency is the sum of the children's frequencies.
-        // A special character '$' is used for internal nodes (data is irrelevant).
-        auto newNode = std::make_shared<HuffmanNode>('$', left->frequency + right->frequency);
-        newNode->left = left;
-        newNode->right = right;
-        pq.push(newNode);
-    }
-    
-    // The remaining node is the root of the Huffman Tree.
-    treeRoot = pq.top();
-}
-
-
-void HuffmanCoding::generateCodes(const std::shared_ptr<HuffmanNode>& node, const std::string& code) {
-    if (!node) {
-        return;
-    }
-    // If it's a leaf node (has a character), store the generated code.
-    if (!node->left && !node->right) {
-        huffmanCodes[node->data] = code;
-    }
-    // Recursively traverse left (append '0') and right (append '1').
-    generateCodes(node->left, code + "0");
-    generateCodes(node->right, code + "1");
-}
-
-void HuffmanCoding::writeHeader(std::ofstream& outputFile) {
-    // The header contains the frequency map, which is needed for decompression.
-    size_t mapSize = frequencyMap.size();
-    outputFile.write(reinterpret_cast<const char*>(&mapSize), sizeof(mapSize));
-
-    // Write the character-frequency pairs.
-    for (const auto& pair : frequencyMap) {
-        outputFile.write(&pair.first, sizeof(pair.first));
-        outputFile.write(reinterpret_cast<const char*>(&pair.second), sizeof(pair.second));
-    }
-}
-
-void HuffmanCoding::writeCompressedData(std::ifstream& inputFile, std::ofstream& outputFile) {
-    // Go back to the beginning of the input file to read its contents.
-    inputFile.clear();
-    inputFile.seekg(0, std::ios::beg);
-
-    char character;
-    unsigned char buffer = 0;
-    int bitCount = 0;
-
-    while (inputFile.get(character)) {
-        std::string code = huffmanCodes[character];
-        for (char bit : code) {
-            // Add the bit to the buffer by left-shifting and ORing.
-            buffer = (buffer << 1) | (bit - '0');
-            bitCount++;
-            // If the buffer is full (8 bits), write it to the file.
-            if (bitCount == 8) {
-                outputFile.put(buffer);
-                buffer = 0;
-                bitCount = 0;
-            }
-        }
-    }
-
-    // Write any remaining bits in the buffer.
-    // This is crucial for the last byte of compressed data.
-    if (bitCount > 0) {
-        buffer <<= (8 - bitCount); // Pad with trailing zeros
-        outputFile.put(buffer);
-    }
-}
-
-
-void HuffmanCoding::compress(const std::string& inputFilePath, const std::string& outputFilePath) {
-    std::ifstream inputFile(inputFilePath, std::ios::binary);
-    if (!inputFile.is_open()) {
-        std::cerr << "Error: Could not open input file: " << inputFilePath << std::endl;
-        return;
-    }
-
-    std::ofstream outputFile(outputFilePath, std::ios::binary);
-    if (!outputFile.is_open()) {
-        std::cerr << "Error: Could not open output file: " << outputFilePath << std::endl;
-        return;
-    }
-
-    std::cout << "Building frequency table..." << std::endl;
-    buildFrequencyTable(inputFile);
-
-    // Handle empty file as a special case.
-    if (frequencyMap.empty()) {
-        std::cout << "Input file is empty. Creating an empty compressed file." << std::endl;
-        inputFile.close();
-        outputFile.close();
-        return;
-    }
-
-    std::cout << "Building Huffman tree..." << std::endl;
-    buildHuffmanTree();
-
-    std::cout << "Generating Huffman codes..." << std::endl;
-    generateCodes(treeRoot, "");
-
-    std::cout << "Writing header..." << std::endl;
-    writeHeader(outputFile);
-
-    std::cout << "Writing compressed data..." << std::endl;
-    writeCompressedData(inputFile, outputFile);
-
-    inputFile.close();
-    outputFile.close();
-
-    std::cout << "Compression successful!" << std::endl;
-}
-
-
-// --- Decompression Implementation ---
-
-void HuffmanCoding::readHeader(std::ifstream& inputFile) {
-    frequencyMap.clear();
-    size_t mapSize;
-    inputFile.read(reinterpret_cast<char*>(&mapSize), sizeof(mapSize));
-
-    // Reconstruct the frequency map by reading from the header.
-    for (size_t i = 0; i < mapSize; ++i) {
-        char character;
-        unsigned frequency;
-        inputFile.read(&character, sizeof(character));
-        inputFile.read(reinterpret_cast<char*>(&frequency), sizeof(frequency));
-        frequencyMap[character] = frequency;
-    }
-}
-
-void HuffmanCoding::decodeData(std::ifstream& inputFile, std::ofstream& outputFile) {
-    // Calculate total number of characters in original file to know when to stop decoding.
-    long long totalChars = 0;
-    for (const auto& pair : frequencyMap) {
-        totalChars += pair.second;
-    }
-    if (totalChars == 0) return;
-
-    auto currentNode = treeRoot;
-    char byte;
-    long long decodedCount = 0;
-
-    while (inputFile.get(byte) && decodedCount < totalChars) {
-        // Process each bit of the byte read from the file.
-        for (int i = 7; i >= 0; --i) {
-            if (decodedCount >= totalChars) break;
-
-            // Get the current bit (0 or 1).
-            int bit = (byte >> i) & 1;
-
-            // Traverse the tree based on the bit.
-            if (bit == 0) {
-                currentNode = currentNode->left;
-            } else {
-                currentNode = currentNode->right;
-            }
-
-            // If it's a leaf node, we've found a character.
-            if (currentNode && !currentNode->left && !currentNode->right) {
-                outputFile.put(currentNode->data);
-                decodedCount++;
-                currentNode = treeRoot; // Return to the root for the next character.
-            }
-        }
-    }
-}
-
-
-void HuffmanCoding::decompress(const std::string& inputFilePath, const std::string& outputFilePath) {
-    std::ifstream inputFile(inputFilePath, std::ios::binary);
-    if (!inputFile.is_open()) {
-        std::cerr << "Error: Could not open input file: " << inputFilePath << std::endl;
-        return;
-    }
-
-    std::ofstream outputFile(outputFilePath, std::ios::binary);
-    if (!outputFile.is_open()) {
-        std::cerr << "Error: Could not open output file: " << outputFilePath << std::endl;
-        return;
-    }
-
-    std::cout << "Reading header..." << std::endl;
-    readHeader(inputFile);
-
-    std::cout << "Rebuilding Huffman tree..." << std::endl;
-    buildHuffmanTree();
-
-    std::cout << "Decoding data..." << std::endl;
-    decodeData(inputFile, outputFile);
-
-    inputFile.close();
-    outputFile.close();
-
-    std::cout << "Decompression successful!" << std::endl;
-}
-
-
-// --- Main Program ---
-void showUsage() {
-    std::cout << "Usage: huffman <command> <input_file> <output_file>" << std::endl;
-    std::cout << "Commands:" << std::endl;
-    std::cout << "  c, compress      Compress the input file." << std::endl;
-    std::cout << "  d, decompress    Decompress the input file." << std::endl;
-}
-
-int main(int argc, char* argv[]) {
-    if (argc != 4) {
-        showUsage();
-        return 1;
-    }
-
-    std::string command = argv[1];
-    std::string inputFile = argv[2];
-    std::string outputFile = argv[3];
-
-    HuffmanCoding hf;
-
-    if (command == "c" || command == "compress") {
-        hf.compress(inputFile, outputFile);
-    } else if (command == "d" || command == "decompress") {
-        hf.decompress(inputFile, outputFile);
-    } else {
-        std::cerr << "Error: Invalid command '" << command << "'" << std::endl;
-        showUsage();
-        return 1;
-    }
-
-    return 0;
-}
\ No newline at end of file
+#include "huffman.h"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <iterator>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <functional>
+#include <chrono>
+#include <iomanip>
+#include <list>
+#include <unordered_map>
+#include <exception>
+#include <new>
+
+#include "bitio.h"
+#include "bulk_encode.h"
+#include "crc32c.h"
+#include "histogram.h"
+#include "output_sink.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HUFFMAN_HAVE_MMAP 1
+#endif
+
+// --- Huffman Tree ---
+// The tree lives in a fixed arena of nodes addressed by 16-bit indices, so
+// building and walking it never allocates or touches reference counts.
+// 256 leaves need at most 255 internal nodes; a single-symbol alphabet needs
+// one leaf plus its dummy parent.
+struct HuffmanTree {
+    static constexpr uint16_t kNoNode = 0xFFFF;
+    static constexpr size_t kMaxNodes = 511;
+
+    // A leaf has no children; an internal node has a left child and, except for
+    // the single-symbol dummy parent, a right child.
+    // Frequencies are 32-bit on purpose: the original format summed them in an
+    // unsigned, and the tree shape must match it exactly, wraparound included.
+    struct Node {
+        unsigned frequency;
+        uint16_t left;
+        uint16_t right;
+        char data;
+
+        bool isLeaf() const { return left == kNoNode && right == kNoNode; }
+    };
+
+    std::array<Node, kMaxNodes> nodes;
+    uint16_t nodeCount = 0;
+    uint16_t root = kNoNode;
+
+    uint16_t addNode(char data, unsigned frequency, uint16_t left = kNoNode, uint16_t right = kNoNode) {
+        nodes[nodeCount] = {frequency, left, right, data};
+        return nodeCount++;
+    }
+};
+
+// --- Container Format ---
+// Canonical-mode files start with a magic and a version byte, followed by a
+// sequence of blocks terminated by an end block. Each block starts with a type
+// byte; data blocks then carry:
+//   original size (varint) | payload size (varint) | [code lengths] | payload
+// A Huffman block has its own code lengths. A table block holds only code
+// lengths, which every following shared block uses for its payload. A
+// dictionary block does the same with a pre-trained table, storing only the
+// table's ID (4 bytes, little-endian) in place of the code lengths. The code
+// lengths of a Huffman block likewise become the table of the shared blocks
+// after it, so a block with the same statistics as the one before can repeat
+// its table instead of storing it again.
+// Interleaved blocks (of either kind) split the payload into four bitstreams,
+// symbol i going to stream i % 4, so a decoder can follow four independent
+// dependency chains at once. Their payload starts with the byte sizes of the
+// first three streams (varints); the fourth takes the rest.
+// A stored block has no code lengths and a payload that is the block itself,
+// uncoded; it is written when coding would save too little to be worth it.
+// A context block codes every byte with the table of its context, the byte
+// before it (zero for a block's first byte). The 256 contexts are clustered
+// into at most kMaxContextGroups groups, each with its own code lengths, and
+// no code is longer than 11 bits. After the sizes the block stores the group
+// count minus one (1 byte); with more than one group, the group of every
+// context (4 bits each, low nibble first); then the code lengths of every
+// group in turn.
+// Blocks of at most four distinct byte values need no code table. A run
+// block holds a single byte value repeated; its payload is that byte. A small
+// alphabet block stores the symbol count (1 byte) and the symbols, then the
+// index of every byte among them, MSB first: 1 bit each with two symbols,
+// 2 bits each with three or four.
+// Any data block may carry a checksum: its type then has kBlockChecksumFlag
+// set, and the CRC32C of its original bytes (4 bytes, little-endian) follows
+// the payload size. Files with checksums also end with a stream checksum
+// block, holding the CRC32C of all the original data, before the end block.
+// Files written to a seekable output with more than one data block end with a
+// block index after the end block, followed by a fixed-size footer:
+//   block count (varint) | per block: original size, block bytes (varints)
+//   index offset (8 bytes, little-endian) | footer magic (4 bytes)
+// Files without the magic are in the original format: a raw frequency table
+// followed by a single bitstream. A legacy header starts with a little-endian
+// symbol count of at most 256, so it can never match the magic.
+static const char kFormatMagic[4] = {'H', 'U', 'F', 'Z'};
+static const char kIndexMagic[4] = {'H', 'U', 'F', 'X'};
+static constexpr uint8_t kFormatVersion = 1;
+static constexpr size_t kFileHeaderSize = sizeof(kFormatMagic) + 1;
+static constexpr size_t kFooterSize = 8 + sizeof(kIndexMagic);
+
+// Block size used when compressing a stream and no block size was given.
+static constexpr size_t kDefaultStreamBlockSize = size_t(1) << 20;
+
+enum BlockType : uint8_t {
+    kBlockEnd = 0,
+    kBlockHuffman = 1,
+    kBlockTable = 2,
+    kBlockShared = 3,
+    kBlockHuffmanInterleaved = 4,
+    kBlockSharedInterleaved = 5,
+    kBlockDictionary = 6,
+    kBlockStored = 7,
+    kBlockStreamChecksum = 8,
+    kBlockContext = 9,
+    kBlockRun = 10,
+    kBlockSmallAlphabet = 11,
+};
+static constexpr uint8_t kBlockChecksumFlag = 0x80;
+
+// Most code tables a context block may have.
+static constexpr int kMaxContextGroups = 16;
+
+// Most distinct byte values a small alphabet block may hold.
+static constexpr size_t kMaxSmallAlphabet = 4;
+
+// A block is only Huffman coded if that saves at least 1/kMinSavingDivisor
+// of its size; otherwise it is stored.
+static constexpr size_t kMinSavingDivisor = 32;
+
+// Pre-trained table files: magic | version | ID (4 bytes, little-endian) |
+// one code length per byte value.
+static const char kTableMagic[4] = {'H', 'U', 'F', 'T'};
+static constexpr uint8_t kTableVersion = 1;
+static constexpr size_t kTableFileSize = sizeof(kTableMagic) + 1 + 4 + 256;
+
+// Table IDs and checksums are stored as 4 little-endian bytes; IDs are shown
+// as 8 hex digits.
+static uint32_t readUint32(const unsigned char* bytes) {
+    return uint32_t(bytes[0]) | uint32_t(bytes[1]) << 8 | uint32_t(bytes[2]) << 16 | uint32_t(bytes[3]) << 24;
+}
+
+static void writeUint32(std::ostream& output, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        output.put(static_cast<char>(value >> (8 * i)));
+    }
+}
+
+// Derives a table's ID from its code lengths (32-bit FNV-1a).
+static uint32_t codeTableId(const std::array<uint8_t, 256>& codeLengths) {
+    uint32_t hash = 2166136261u;
+    for (uint8_t length : codeLengths) {
+        hash = (hash ^ length) * 16777619u;
+    }
+    return hash;
+}
+
+static std::string tableIdString(uint32_t id) {
+    char text[9];
+    std::snprintf(text, sizeof(text), "%08x", static_cast<unsigned>(id));
+    return text;
+}
+
+// Bytes a payload may exceed its worst-case bit count by: the final partial
+// byte of every stream plus the interleaved stream sizes.
+static constexpr size_t kMaxPayloadSlack = kInterleavedStreams * (1 + 10);
+
+// Largest piece of a block payload read from a stream at once.
+static constexpr size_t kStreamReadChunk = size_t(1) << 20;
+
+// Decoded bytes the parallel block decoder holds at once, beyond a window's
+// first block. Run blocks take none, as they are written without expanding.
+static constexpr uint64_t kDecodeWindowBytes = uint64_t(1) << 28;
+
+static bool isDataBlock(uint8_t type) {
+    return type == kBlockHuffman || type == kBlockShared || type == kBlockHuffmanInterleaved ||
+           type == kBlockSharedInterleaved || type == kBlockStored || type == kBlockContext || type == kBlockRun ||
+           type == kBlockSmallAlphabet;
+}
+
+// Data blocks with a coded payload, which need a code table to decode.
+static bool isCoded(uint8_t type) {
+    return isDataBlock(type) && type != kBlockStored && type != kBlockRun && type != kBlockSmallAlphabet;
+}
+
+// Whether a data block's sizes can be genuine, checked before anything is
+// allocated for it: the block is within kMaxBlockSize, its payload is no
+// longer than the longest codes need, and it holds at least one bit per
+// byte, as every code takes one. Only a run block codes any number of bytes
+// in a single payload byte; it is never expanded in memory.
+static bool plausibleBlockSizes(uint8_t type, uint64_t originalSize, uint64_t payloadSize) {
+    if (originalSize > kMaxBlockSize ||
+        payloadSize > originalSize * kMaxCodeLengthLimit / 8 + kMaxPayloadSlack) {
+        return false;
+    }
+    return type == kBlockRun || originalSize <= payloadSize * 8;
+}
+
+// Data blocks that store their own code lengths rather than using the last
+// table or dictionary block.
+static bool hasOwnTable(uint8_t type) {
+    return type == kBlockHuffman || type == kBlockHuffmanInterleaved;
+}
+
+static bool isInterleaved(uint8_t type) {
+    return type == kBlockHuffmanInterleaved || type == kBlockSharedInterleaved;
+}
+
+// --- Input Source ---
+// Presents the whole input as one contiguous, read-only buffer so compression
+// can count frequencies and encode in memory. Regular files are memory-mapped;
+// anything else (pipes, character devices) is read with large read() calls
+// into a heap buffer.
+class InputSource {
+public:
+    InputSource() = default;
+    ~InputSource() { close(); }
+    InputSource(const InputSource&) = delete;
+    InputSource& operator=(const InputSource&) = delete;
+
+    bool open(const std::string& path);
+    void assign(std::vector<unsigned char> bytes);
+    void wrap(const unsigned char* data, size_t size);
+    void close();
+
+    const unsigned char* data() const { return view; }
+    size_t size() const { return viewSize; }
+
+private:
+    const unsigned char* view = nullptr;
+    size_t viewSize = 0;
+    bool mapped = false;
+    std::vector<unsigned char> buffer;
+};
+
+bool InputSource::open(const std::string& path) {
+    close();
+#ifdef HUFFMAN_HAVE_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void* address = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address != MAP_FAILED) {
+            madvise(address, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+            view = static_cast<const unsigned char*>(address);
+            viewSize = static_cast<size_t>(info.st_size);
+            mapped = true;
+            ::close(fd);
+            return true;
+        }
+    }
+
+    // Not mappable: read the stream in large blocks until end of input.
+    const size_t blockSize = size_t(1) << 20;
+    size_t used = 0;
+    for (;;) {
+        buffer.resize(used + blockSize);
+        ssize_t got = ::read(fd, buffer.data() + used, blockSize);
+        if (got < 0) {
+            ::close(fd);
+            buffer.clear();
+            return false;
+        }
+        if (got == 0) break;
+        used += static_cast<size_t>(got);
+    }
+    ::close(fd);
+    buffer.resize(used);
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+#endif
+    view = buffer.data();
+    viewSize = buffer.size();
+    return true;
+}
+
+// Takes ownership of bytes that were already read from somewhere else.
+void InputSource::assign(std::vector<unsigned char> bytes) {
+    close();
+    buffer = std::move(bytes);
+    view = buffer.data();
+    viewSize = buffer.size();
+}
+
+// Views memory owned by the caller, which must outlive the source.
+void InputSource::wrap(const unsigned char* data, size_t size) {
+    close();
+    view = data;
+    viewSize = size;
+}
+
+void InputSource::close() {
+#ifdef HUFFMAN_HAVE_MMAP
+    if (mapped) {
+        munmap(const_cast<unsigned char*>(view), viewSize);
+    }
+#endif
+    mapped = false;
+    view = nullptr;
+    viewSize = 0;
+    buffer.clear();
+    buffer.shrink_to_fit();
+}
+
+// --- Byte Cursor ---
+// A bounds-checked reader over an in-memory buffer, used to parse headers out
+// of a mapped compressed file. Every read fails cleanly at the end of data.
+struct ByteCursor {
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+    size_t pos = 0;
+
+    size_t remaining() const { return size - pos; }
+
+    bool get(uint8_t& value) {
+        if (pos >= size) return false;
+        value = data[pos++];
+        return true;
+    }
+
+    bool skip(size_t count) {
+        if (count > remaining()) return false;
+        pos += count;
+        return true;
+    }
+
+    // Sizes in the container are stored as LEB128 varints: 7 bits per byte,
+    // low bits first, with the high bit set on every byte but the last.
+    bool readVarint(uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t byte;
+            if (!get(byte)) return false;
+            value |= uint64_t(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    }
+};
+
+static void writeVarint(std::ostream& output, uint64_t value) {
+    while (value >= 0x80) {
+        output.put(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    output.put(static_cast<char>(value));
+}
+
+static bool readVarint(std::istream& input, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        char byte;
+        if (!input.get(byte)) return false;
+        value |= uint64_t(static_cast<unsigned char>(byte) & 0x7F) << shift;
+        if (!(static_cast<unsigned char>(byte) & 0x80)) return true;
+    }
+    return false;
+}
+
+// Reads a code-length table from a stream as raw bytes, for loadTable().
+// With `append`, the bytes are added to `table` instead of replacing it.
+static bool readTableBytes(std::istream& input, std::vector<unsigned char>& table, bool append = false) {
+    char countByte;
+    if (!input.get(countByte)) return false;
+    size_t symbolCount = size_t(static_cast<unsigned char>(countByte)) + 1;
+    size_t start = append ? table.size() : 0;
+    table.resize(start + 1 + (symbolCount < 128 ? 2 * symbolCount : 256));
+    table[start] = static_cast<unsigned char>(countByte);
+    input.read(reinterpret_cast<char*>(table.data() + start + 1), table.size() - start - 1);
+    return static_cast<size_t>(input.gcount()) == table.size() - start - 1;
+}
+
+// Reads the `size` byte payload of a block from a stream. The buffer grows a
+// chunk at a time, so a forged size allocates no more than the stream holds.
+static bool readBlockBytes(std::istream& input, uint64_t size, std::vector<unsigned char>& bytes) {
+    bytes.clear();
+    while (bytes.size() < size) {
+        size_t start = bytes.size();
+        size_t wanted = static_cast<size_t>(std::min<uint64_t>(size - start, kStreamReadChunk));
+        bytes.resize(start + wanted);
+        input.read(reinterpret_cast<char*>(bytes.data() + start), wanted);
+        if (static_cast<size_t>(input.gcount()) != wanted) return false;
+    }
+    return true;
+}
+
+// Reads the context map and code lengths of a context block from a stream.
+static bool readContextTableBytes(std::istream& input, std::vector<unsigned char>& table) {
+    char countByte;
+    if (!input.get(countByte)) return false;
+    size_t groups = size_t(static_cast<unsigned char>(countByte)) + 1;
+    if (groups > kMaxContextGroups) return false;
+    table.assign(1, static_cast<unsigned char>(countByte));
+    if (groups > 1) {
+        table.resize(1 + 128);
+        input.read(reinterpret_cast<char*>(table.data() + 1), 128);
+        if (input.gcount() != 128) return false;
+    }
+    for (size_t group = 0; group < groups; ++group) {
+        if (!readTableBytes(input, table, true)) return false;
+    }
+    return true;
+}
+
+// Size of a legacy header at `data`, or zero if it is truncated or longer
+// than one entry per byte value, which the table cache then skips.
+static size_t legacyHeaderBytes(const unsigned char* data, size_t size) {
+    if (size < 8) return 0;
+    uint64_t mapSize = 0;
+    for (int i = 0; i < 8; ++i) {
+        mapSize |= uint64_t(data[i]) << (8 * i);
+    }
+    if (mapSize > 256 || 8 + mapSize * (1 + sizeof(unsigned)) > size) return 0;
+    return static_cast<size_t>(8 + mapSize * (1 + sizeof(unsigned)));
+}
+
+// Key of a decode table cache entry: the kind of table and its serialized bytes.
+static constexpr char kLegacyTables = 'L';
+static constexpr char kCanonicalTables = 'C';
+static std::string tableCacheKey(char kind, const unsigned char* table, size_t tableBytes) {
+    std::string key(1, kind);
+    key.append(reinterpret_cast<const char*>(table), tableBytes);
+    return key;
+}
+
+// Moves a cursor past one code-length table.
+static bool skipCodeLengths(ByteCursor& cursor) {
+    uint8_t countByte;
+    if (!cursor.get(countByte)) return false;
+    size_t symbolCount = size_t(countByte) + 1;
+    return cursor.skip(symbolCount < 128 ? 2 * symbolCount : 256);
+}
+
+// Moves a cursor past the context map and code lengths of a context block.
+static bool skipContextTables(ByteCursor& cursor) {
+    uint8_t countByte;
+    if (!cursor.get(countByte)) return false;
+    size_t groups = size_t(countByte) + 1;
+    if (groups > kMaxContextGroups || (groups > 1 && !cursor.skip(128))) return false;
+    for (size_t group = 0; group < groups; ++group) {
+        if (!skipCodeLengths(cursor)) return false;
+    }
+    return true;
+}
+
+// --- Parallel Helper ---
+// Runs task(index, worker) for every index in [0, count) on up to `threads`
+// threads. Each worker number is owned by exactly one thread, so tasks may use
+// it to pick per-thread state.
+template <typename Task>
+static void parallelFor(size_t count, unsigned threads, Task task) {
+    unsigned workers = static_cast<unsigned>(std::min<size_t>(threads, count));
+    if (workers <= 1) {
+        for (size_t i = 0; i < count; ++i) task(i, 0u);
+        return;
+    }
+    // The first exception a task throws stops the other workers taking new
+    // tasks and is rethrown to the caller.
+    std::atomic<size_t> next(0);
+    std::exception_ptr failure;
+    std::mutex failureMutex;
+    std::vector<std::thread> pool;
+    for (unsigned worker = 0; worker < workers; ++worker) {
+        pool.emplace_back([&, worker]() {
+            try {
+                for (size_t i = next++; i < count; i = next++) task(i, worker);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(failureMutex);
+                if (!failure) failure = std::current_exception();
+                next = count;
+            }
+        });
+    }
+    for (auto& thread : pool) thread.join();
+    if (failure) std::rethrow_exception(failure);
+}
+
+static unsigned resolveThreads(unsigned threads) {
+    if (threads) return threads;
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// --- Pipeline Rings ---
+// A bounded single-producer, single-consumer queue of slot numbers, which
+// connects two pipeline stages. Each side owns one index, so pushing and
+// popping take no lock. A side that finds the ring full or empty spins
+// briefly, then sleeps until the other side moves it or the pipeline stops.
+class SlotRing {
+public:
+    explicit SlotRing(size_t capacity) : items(capacity + 1) {}
+
+    bool push(size_t item, const std::atomic<bool>& stop) {
+        size_t next = (tail.load(std::memory_order_relaxed) + 1) % items.size();
+        if (!wait([&] { return next != head.load(); }, stop)) return false;
+        items[tail.load(std::memory_order_relaxed)] = item;
+        tail.store(next);
+        wakeSleepers();
+        return true;
+    }
+
+    bool pop(size_t& item, const std::atomic<bool>& stop) {
+        size_t current = head.load(std::memory_order_relaxed);
+        if (!wait([&] { return current != tail.load(); }, stop)) return false;
+        item = items[current];
+        head.store((current + 1) % items.size());
+        wakeSleepers();
+        return true;
+    }
+
+    // Wakes a sleeping side so it notices the pipeline stopped.
+    void wake() {
+        std::lock_guard<std::mutex> lock(mutex);
+        changed.notify_all();
+    }
+
+private:
+    static constexpr int kSpins = 64;
+
+    // Waits until `ready`, or returns false once `stop` is set. The sleeper
+    // count is raised before `ready` is checked again under the lock, and
+    // the other side reads it after moving its index, so a wakeup is never
+    // lost.
+    template <typename Ready>
+    bool wait(Ready ready, const std::atomic<bool>& stop) {
+        for (int spin = 0; spin < kSpins; ++spin) {
+            if (ready()) return true;
+            if (stop.load(std::memory_order_relaxed)) return false;
+            std::this_thread::yield();
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        sleepers.fetch_add(1);
+        changed.wait(lock, [&] { return ready() || stop.load(); });
+        sleepers.fetch_sub(1);
+        return ready();
+    }
+
+    void wakeSleepers() {
+        if (sleepers.load() == 0) return;
+        std::lock_guard<std::mutex> lock(mutex);
+        changed.notify_all();
+    }
+
+    std::vector<size_t> items;
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+    std::atomic<int> sleepers{0};
+    std::mutex mutex;
+    std::condition_variable changed;
+};
+
+// --- Phase Timing ---
+// Adds its own lifetime to one phase's total and counts the run.
+class PhaseTimer {
+public:
+    PhaseTimer(CodingStats& stats, Phase phase) : slot(stats.seconds[phase]), start(std::chrono::steady_clock::now()) {
+        stats.calls[phase]++;
+    }
+    ~PhaseTimer() { slot += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); }
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+private:
+    double& slot;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Swallows progress messages in quiet mode; a stream without a buffer
+// discards everything written to it.
+static std::ostream nullStream(nullptr);
+
+// --- Vector Stream Buffer ---
+// Appends everything written through it to a byte vector, so the
+// stream-based coders can write straight into caller memory.
+class VectorStreamBuffer : public std::streambuf {
+public:
+    explicit VectorStreamBuffer(std::vector<unsigned char>& bytes) : bytes(bytes) {}
+
+protected:
+    int_type overflow(int_type c) override {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            bytes.push_back(static_cast<unsigned char>(c));
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char* data, std::streamsize count) override {
+        bytes.insert(bytes.end(), data, data + count);
+        return count;
+    }
+
+private:
+    std::vector<unsigned char>& bytes;
+};
+
+// --- Slice Stream Buffer ---
+// Passes on only the bytes at positions [skip, skip + length) of what is
+// written through it and discards the rest, so a decoder that has to start
+// at a block boundary can produce an arbitrary byte range.
+class SliceStreamBuffer : public std::streambuf {
+public:
+    SliceStreamBuffer(std::ostream& target, uint64_t skip, uint64_t length)
+        : target(target), skip(skip), length(length) {}
+
+protected:
+    int_type overflow(int_type c) override {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            char byte = traits_type::to_char_type(c);
+            xsputn(&byte, 1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char* data, std::streamsize count) override {
+        uint64_t size = static_cast<uint64_t>(count);
+        uint64_t dropped = std::min(skip, size);
+        skip -= dropped;
+        uint64_t passed = std::min(length, size - dropped);
+        length -= passed;
+        if (passed) target.write(data + dropped, static_cast<std::streamsize>(passed));
+        return target ? count : 0;
+    }
+
+    int sync() override { return target.flush() ? 0 : -1; }
+
+private:
+    std::ostream& target;
+    uint64_t skip;
+    uint64_t length;
+};
+
+// --- Huffman Coder ---
+// The state and logic behind a HuffmanCoding context.
+class HuffmanCoder {
+public:
+    bool compress(const std::string& inputFilePath, const std::string& outputFilePath,
+                  const CompressionOptions& options);
+    bool decompress(const std::string& inputFilePath, const std::string& outputFilePath,
+                    const DecompressionOptions& options);
+    bool compress(const unsigned char* data, size_t size, std::vector<unsigned char>& output,
+                  const CompressionOptions& options);
+    bool decompress(const unsigned char* data, size_t size, std::vector<unsigned char>& output,
+                    const DecompressionOptions& options);
+    bool decompress(std::istream& input, std::ostream& output, const DecompressionOptions& options);
+    bool extract(const std::string& inputFilePath, const std::string& outputFilePath, uint64_t offset,
+                 uint64_t length, const DecompressionOptions& options);
+    bool extract(const unsigned char* data, size_t size, uint64_t offset, uint64_t length,
+                 std::vector<unsigned char>& output, const DecompressionOptions& options);
+
+    bool buildCodeTable(const std::array<uint64_t, 256>& counts, int maxCodeLength, CodeTable& table);
+
+    void setQuiet(bool enabled) { quiet = enabled; }
+    const PhaseTimes& phaseTimes() const { return stats.seconds; }
+    const CodingStats& codingStats() const { return stats; }
+    void resetStats() { stats = CodingStats(); }
+    void resetPhaseTimes() { stats.seconds.fill(0); }
+
+private:
+    // A Huffman code packed into the low `length` bits of `bits`, MSB first.
+    struct HuffmanCode {
+        uint64_t bits = 0;
+        uint8_t length = 0;
+    };
+
+    // Per-symbol tables, indexed by byte value. A frequency of zero means the
+    // byte does not occur, and its code is unused.
+    std::array<uint64_t, 256> frequencies{};
+    std::array<HuffmanCode, 256> huffmanCodes{};
+    HuffmanTree tree;
+
+    // Helper methods for compression
+    void buildFrequencyTable(const unsigned char* data, size_t size);
+    void buildHuffmanTree();
+    void buildCodeLengths();
+    bool generateCodes(uint16_t node, uint64_t bits, int length);
+    void writeHeader(std::ostream& outputFile);
+    void writeCompressedData(const unsigned char* data, size_t size, std::ostream& output);
+
+    // Helper methods for canonical-mode compression
+    bool buildCanonicalCodes(const unsigned char* data, size_t size, int lengthLimit);
+    bool buildCanonicalCodes(int lengthLimit);
+    void limitCodeLengths(int lengthLimit);
+    bool assignCanonicalCodes();
+    bool codesFromLengths();
+    bool useCodeTable(const CodeTable& table);
+    void writeCodeLengths(std::ostream& output);
+    bool worthCoding(size_t size, bool shared) const;
+    bool bulkCodeTable(std::array<uint32_t, 256>& table) const;
+    bool repeatsTable(const std::array<uint8_t, 256>& previousTable);
+    std::array<uint8_t, 256> tableInForce(const std::array<uint8_t, 256>* previousTable, int maxCodeLength);
+    void countBlock(const unsigned char* data, size_t size, const CompressionOptions& options, uint32_t& checksum);
+    bool encodeBlock(const unsigned char* data, size_t size, const CompressionOptions& options,
+                     const std::array<uint8_t, 256>* previousTable, uint32_t checksum, std::string& block);
+    // Supplies the next input block into buffer slot `slot` (valid until the
+    // slot is handed out again); returns false once the input is exhausted.
+    using BlockSource = std::function<bool(size_t slot, const unsigned char*& data, size_t& size)>;
+    bool compressBlocks(std::ostream& output, const CompressionOptions& options, const InputSource* wholeInput,
+                        const BlockSource& nextBlock, bool writeIndex);
+
+    // Helper methods for decompression
+    bool readHeader(ByteCursor& cursor);
+    uint64_t legacyPayloadBits() const;
+    void buildDecodeTable(uint16_t node, uint32_t code, int length);
+    bool decodeSymbol(BitReader& reader, char& symbol) const;
+    size_t decodeSymbols(const unsigned char* input, size_t inputSize, uint64_t& bitPosition,
+                         char* output, size_t count);
+    bool decodeInterleaved(const unsigned char* payload, size_t payloadSize, char* output, size_t count);
+    static bool splitStreams(const unsigned char* payload, size_t payloadSize,
+                             const unsigned char* (&starts)[kInterleavedStreams],
+                             size_t (&sizes)[kInterleavedStreams]);
+    bool decodeBlock(uint8_t type, const unsigned char* payload, size_t payloadSize, char* output, size_t count);
+    bool decodeToStream(const unsigned char* input, size_t inputSize, uint64_t count, std::ostream& outputFile);
+    bool decompressLegacy(const InputSource& input, std::ostream& outputFile, const DecompressionOptions& options);
+
+    // Whole-input coding shared by the file and buffer entry points.
+    bool compressInput(const InputSource& input, std::ostream& output, const CompressionOptions& options,
+                       bool writeIndex);
+    bool decompressInput(const InputSource& input, std::ostream& output, const DecompressionOptions& options);
+    bool extractInput(const InputSource& input, std::ostream& output, uint64_t offset, uint64_t length,
+                      const DecompressionOptions& options);
+
+    // Location of one block inside a mapped container. For shared blocks,
+    // `table` points at the code lengths of the preceding table block.
+    // `checksum` is the stored CRC32C, of the block or (for a stream checksum
+    // block) of the whole input.
+    struct BlockInfo {
+        uint8_t type = kBlockEnd;
+        uint64_t originalSize = 0;
+        const unsigned char* table = nullptr;
+        size_t tableBytes = 0;
+        const unsigned char* payload = nullptr;
+        size_t payloadSize = 0;
+        bool checksummed = false;
+        uint32_t checksum = 0;
+    };
+
+    // One entry of the trailing block index.
+    struct IndexEntry {
+        uint64_t offset = 0;
+        uint64_t originalSize = 0;
+    };
+
+    // Helper methods for canonical-mode decompression
+    static bool readBlockIndex(const unsigned char* data, size_t size, std::vector<IndexEntry>& entries);
+    bool parseBlock(ByteCursor& cursor, const DecompressionOptions& options, const unsigned char*& sharedTable,
+                    size_t& sharedTableBytes, BlockInfo& block);
+    bool locateBlocks(const InputSource& input, const DecompressionOptions& options, std::vector<BlockInfo>& blocks);
+    bool locateRange(const InputSource& input, const DecompressionOptions& options, uint64_t offset,
+                     uint64_t length, std::vector<BlockInfo>& blocks, uint64_t& skip);
+    bool decompressContainer(const InputSource& input, std::ostream& outputFile,
+                             const DecompressionOptions& options);
+    bool decodeBlocks(const std::vector<BlockInfo>& blocks, std::ostream& outputFile,
+                      const DecompressionOptions& options);
+    uint32_t computeChecksum(uint32_t crc, const unsigned char* data, size_t size);
+    bool verifyBlock(bool checksummed, uint32_t stored, uint32_t actual, uint64_t size, uint32_t& streamChecksum);
+    bool verifyStream(uint32_t stored, uint32_t actual);
+    bool decompressStream(std::istream& input, std::ostream& outputFile, const DecompressionOptions& options);
+    const std::vector<unsigned char>* findDictionary(uint32_t id, const DecompressionOptions& options);
+    bool readCodeLengths(ByteCursor& cursor);
+    bool loadTable(const unsigned char* table, size_t tableBytes);
+    bool loadBlockTables(uint8_t type, const unsigned char* table, size_t tableBytes);
+    bool buildCanonicalDecodeTable();
+
+    // Helper methods for order-1 context coding
+    void countContexts(const unsigned char* data, size_t size);
+    void clusterContexts();
+    bool encodeContextBlock(const unsigned char* data, size_t size, const CompressionOptions& options, uint8_t flag,
+                            uint32_t checksum, std::string& block);
+    bool loadContextTables(const unsigned char* table, size_t tableBytes);
+    bool decodeContext(const unsigned char* payload, size_t payloadSize, char* output, size_t count);
+
+    // Helper methods for run and small alphabet blocks
+    bool encodeSmallAlphabet(const unsigned char* data, size_t size, bool shared, uint8_t flag, uint32_t checksum,
+                             std::string& block);
+    bool decodeSmallAlphabet(const unsigned char* payload, size_t payloadSize, char* output, size_t count);
+    template <int Width>
+    static bool expandIndices(const unsigned char* packed, size_t packedBytes, const unsigned char* symbols,
+                              size_t symbolCount, char* output, size_t count);
+    bool decodeLegacyRun(const unsigned char* input, size_t inputSize, uint64_t count, char symbol,
+                         std::ostream& outputFile);
+    bool writeRunBlock(const unsigned char* payload, size_t payloadSize, uint64_t count, bool checksummed,
+                       uint32_t stored, uint32_t& streamChecksum, std::ostream& outputFile);
+    uint32_t runChecksum(unsigned char symbol, uint64_t count);
+    void writeRun(char symbol, uint64_t count, std::ostream& outputFile);
+
+    // Helper methods for parallel legacy decoding. A segment is a stretch of
+    // the legacy bitstream decoded from a guessed start: its symbols, the bit
+    // position of each of its first kSyncSymbols codes, and where it stopped.
+    static constexpr size_t kLegacySegmentBytes = size_t(1) << 17;
+    static constexpr size_t kSyncSymbols = 4096;
+    struct LegacySegment {
+        std::vector<char> symbols;
+        size_t count = 0;
+        std::vector<uint64_t> starts;
+        uint64_t end = 0;
+        bool failed = false;
+    };
+    void decodeSegment(const unsigned char* input, size_t inputSize, uint64_t start, uint64_t limit,
+                       LegacySegment& segment) const;
+    bool decodeLegacyParallel(const unsigned char* input, size_t inputSize, uint64_t count, unsigned threads,
+                              std::ostream& outputFile);
+
+    // --- Table-driven decoding ---
+    // Number of bits resolved by a single lookup in the decode table.
+    static constexpr int kLookupBits = 11;
+
+    // Longest canonical code the decoder accepts. After a refill the bit
+    // accumulator always holds at least this many bits, so a whole code can be
+    // matched without refilling mid-symbol.
+    static constexpr int kMaxCodeLength = 57;
+    static_assert(kMaxCodeLength == kMaxCodeLengthLimit, "length caps must stay decodable");
+
+    // One slot of the decode table, indexed by the next kLookupBits bits of input.
+    // For codes of at most kLookupBits bits, the slot holds the decoded symbol and
+    // its code length. For longer codes, the slot holds either the internal node
+    // reached after kLookupBits bits (legacy trees, finished by a tree walk) or is
+    // marked as a long canonical code (finished by comparing against the first
+    // code of each length). A length of 0 marks a bit pattern no code starts with.
+    struct DecodeEntry {
+        uint16_t subtree = HuffmanTree::kNoNode;
+        char symbol = 0;
+        uint8_t length = 0;
+        bool longCanonical = false;
+    };
+    std::array<DecodeEntry, size_t(1) << kLookupBits> decodeTable;
+
+    // Canonical code description: the code length of every byte value, plus the
+    // per-length tables used to resolve codes longer than the lookup window.
+    std::array<uint8_t, 256> codeLengths{};
+    std::array<uint64_t, kMaxCodeLength + 1> firstCode{};
+    std::array<uint32_t, kMaxCodeLength + 1> lengthCount{};
+    std::array<uint32_t, kMaxCodeLength + 1> firstSymbolIndex{};
+    std::array<unsigned char, 256> canonicalSymbols{};
+    size_t canonicalSymbolCount = 0;
+    int maxCodeLength = 0;
+
+    // Code lengths the decode table was last built from, so blocks that share
+    // a table do not rebuild it.
+    const unsigned char* loadedTable = nullptr;
+
+    // --- Specialized decode kernels ---
+    // A decode table slot that resolves a whole code: the symbol and its length,
+    // zero for a bit pattern no code starts with.
+    struct LookupEntry {
+        unsigned char symbol = 0;
+        uint8_t length = 0;
+    };
+    // Lookup widths with a compiled kernel. Tables whose codes all fit
+    // kMaxKernelBits also get a compact table exactly as wide as the longest
+    // code (at least kMinKernelBits), and loading the table picks the kernel
+    // instantiated for that width, so the decode loop runs with constant
+    // shifts and masks and a fixed number of symbols per refill.
+    static constexpr int kMinKernelBits = 9;
+    static constexpr int kMaxKernelBits = 12;
+    std::array<LookupEntry, size_t(1) << kMaxKernelBits> kernelTable{};
+    using DecodeKernel = bool (HuffmanCoder::*)(const unsigned char* payload, size_t payloadSize, char* output,
+                                                size_t count);
+    // Kernels for single-stream and interleaved blocks, or null when the
+    // loaded codes are too long and the generic decoders have to handle them.
+    DecodeKernel singleStreamKernel = nullptr;
+    DecodeKernel interleavedKernel = nullptr;
+    void fillLookupTable(LookupEntry* table, int width) const;
+    void selectDecodeKernels();
+    template <int Width, int Streams>
+    bool decodeWithKernel(const unsigned char* payload, size_t payloadSize, char* output, size_t count);
+
+    // --- Decode table cache ---
+    // The cache the current call shares built tables through, if any. An
+    // entry holds a legacy tree with its decode table and symbol count, or a
+    // canonical code layout with its decode table and kernel table. Legacy
+    // entries also keep the symbol and payload bit counts the header implies.
+    friend struct DecodeTableCache::Impl;
+    struct CachedTables {
+        bool legacy = false;
+        uint64_t symbolCount = 0;
+        uint64_t payloadBits = 0;
+        HuffmanTree tree;
+        std::array<DecodeEntry, size_t(1) << kLookupBits> decodeTable;
+        std::array<uint8_t, 256> codeLengths{};
+        std::array<uint64_t, kMaxCodeLength + 1> firstCode{};
+        std::array<uint32_t, kMaxCodeLength + 1> lengthCount{};
+        std::array<uint32_t, kMaxCodeLength + 1> firstSymbolIndex{};
+        std::array<unsigned char, 256> canonicalSymbols{};
+        size_t canonicalSymbolCount = 0;
+        int maxCodeLength = 0;
+        std::array<LookupEntry, size_t(1) << kMaxKernelBits> kernelTable{};
+        DecodeKernel singleStreamKernel = nullptr;
+        DecodeKernel interleavedKernel = nullptr;
+    };
+    DecodeTableCache* tableCache = nullptr;
+    std::shared_ptr<const CachedTables> findCachedTables(const std::string& key);
+    void cacheTables(std::string key, bool legacy, uint64_t symbolCount, uint64_t payloadBits);
+    void restoreTables(const CachedTables& cached);
+
+    // --- Order-1 context state ---
+    // Counts of every (previous byte, byte) pair of the current block, and
+    // the group of every context with the number of groups.
+    std::vector<uint32_t> contextCounts;
+    std::array<uint8_t, 256> contextGroup{};
+    size_t contextGroupCount = 0;
+    // Encoder: the codes of every group.
+    std::vector<std::array<HuffmanCode, 256>> groupCodes;
+    // Decoder: one lookup table per group, all codes resolved by a single
+    // lookup, and the offset of each context's table in `contextTables`.
+    std::vector<LookupEntry> contextTables;
+    std::array<uint32_t, 256> contextTableOffset{};
+
+    // Pre-trained tables referenced by the current input, serialized like a
+    // table block, and the ID of one that was needed but not supplied.
+    std::vector<std::pair<uint32_t, std::vector<unsigned char>>> dictionaries;
+    bool dictionaryMissing = false;
+    uint32_t missingDictionary = 0;
+
+    // Set when decoded data does not match its stored checksum.
+    bool checksumMismatch = false;
+
+    // Destination of progress messages; stderr when the output goes to stdout.
+    std::ostream* progress = &nullStream;
+    bool quiet = true;
+
+    CodingStats stats;
+    void countBytes(Phase phase, uint64_t in, uint64_t out) {
+        stats.bytesIn[phase] += in;
+        stats.bytesOut[phase] += out;
+    }
+    uint64_t codedBits() const;
+
+    // Per-thread contexts for block-parallel coding, kept between calls.
+    std::vector<HuffmanCoder> workers;
+    void prepareWorkers(unsigned count);
+
+    // Coded data size in bits of every length-capped block, with the capped
+    // codes and with the unconstrained codes they replaced.
+    uint64_t cappedBits = 0;
+    uint64_t uncappedBits = 0;
+
+    void addWorkerStats(const HuffmanCoder& worker);
+    void reportLengthCap(const CompressionOptions& options);
+};
+
+// Makes `count` worker contexts available, each starting from a clean state.
+void HuffmanCoder::prepareWorkers(unsigned count) {
+    if (workers.size() < count) {
+        workers.resize(count);
+    }
+    for (auto& worker : workers) {
+        worker.stats = CodingStats();
+        worker.cappedBits = worker.uncappedBits = 0;
+        worker.loadedTable = nullptr;
+    }
+}
+
+// Folds a worker's phase times and length-cap counters into this coder's.
+void HuffmanCoder::addWorkerStats(const HuffmanCoder& worker) {
+    stats += worker.stats;
+    cappedBits += worker.cappedBits;
+    uncappedBits += worker.uncappedBits;
+}
+
+// --- Compression Implementation ---
+
+// Tells what the code length cap cost, relative to unconstrained codes.
+void HuffmanCoder::reportLengthCap(const CompressionOptions& options) {
+    if (!options.maxCodeLength) {
+        return;
+    }
+    if (cappedBits == 0) {
+        *progress << "No code exceeded the " << options.maxCodeLength << "-bit length cap." << std::endl;
+        return;
+    }
+    uint64_t extraBytes = (cappedBits - uncappedBits + 7) / 8;
+    double percent = 100.0 * double(cappedBits - uncappedBits) / double(uncappedBits);
+    *progress << "The " << options.maxCodeLength << "-bit length cap added " << extraBytes << " bytes (+"
+              << std::fixed << std::setprecision(3) << percent << "%) to the capped blocks." << std::endl;
+    *progress << std::defaultfloat;
+}
+
+void HuffmanCoder::buildFrequencyTable(const unsigned char* data, size_t size) {
+    PhaseTimer timer(stats, kPhaseFrequencyTable);
+    countFrequencies(data, size, frequencies.data());
+    countBytes(kPhaseFrequencyTable, size, 0);
+}
+
+void HuffmanCoder::buildHuffmanTree() {
+    PhaseTimer timer(stats, kPhaseTree);
+    // Min-heap of node indices, ordered by frequency. It uses the same heap
+    // algorithm std::priority_queue does, so ties resolve as they always have.
+    std::array<uint16_t, 256> heap;
+    size_t heapSize = 0;
+    auto compare = [this](uint16_t l, uint16_t r) {
+        return tree.nodes[l].frequency > tree.nodes[r].frequency;
+    };
+    auto push = [&](uint16_t node) {
+        heap[heapSize++] = node;
+        std::push_heap(heap.begin(), heap.begin() + heapSize, compare);
+    };
+    auto pop = [&]() {
+        std::pop_heap(heap.begin(), heap.begin() + heapSize, compare);
+        return heap[--heapSize];
+    };
+
+    tree.nodeCount = 0;
+    tree.root = HuffmanTree::kNoNode;
+
+    // Create a leaf node for each character and add it to the priority queue.
+    // Leaves are pushed in signed-char order, the order the original format
+    // always used, because ties in the queue make the tree shape depend on it.
+    for (int character = -128; character < 128; ++character) {
+        uint64_t frequency = frequencies[static_cast<unsigned char>(character)];
+        if (frequency) {
+            push(tree.addNode(static_cast<char>(character), static_cast<unsigned>(frequency)));
+        }
+    }
+
+    // Edge Case: If the file is empty, the priority queue will be empty.
+    if (heapSize == 0) {
+        return;
+    }
+
+    // Edge Case: If there is only one unique character in the file.
+    // The tree must have at least two levels to be traversable.
+    // We create a dummy parent node to ensure codes can be generated and decoded.
+    if (heapSize == 1) {
+        uint16_t singleNode = pop();
+        push(tree.addNode('$', tree.nodes[singleNode].frequency, singleNode));
+    }
+
+    // Main loop to build the tree.
+    // Continues until only one node remains in the queue, which is the root.
+    while (heapSize > 1) {
+        // Extract the two nodes with the lowest frequency.
+        uint16_t left = pop();
+        uint16_t right = pop();
+
+        // Create a new internal node with these two nodes as children.
+        // The frequency is the sum of the children's frequencies.
+        // A special character '$' is used for internal nodes (data is irrelevant).
+        push(tree.addNode('$', tree.nodes[left].frequency + tree.nodes[right].frequency, left, right));
+    }
+
+    // The remaining node is the root of the Huffman Tree.
+    tree.root = heap[0];
+}
+
+
+// Assigns every leaf below `node` its path as a code. Returns false if a code
+// would be longer than the 64 bits a HuffmanCode can hold.
+bool HuffmanCoder::generateCodes(uint16_t node, uint64_t bits, int length) {
+    if (node == HuffmanTree::kNoNode) {
+        return true;
+    }
+    // If it's a leaf node (has a character), store the generated code.
+    const HuffmanTree::Node& current = tree.nodes[node];
+    if (current.isLeaf()) {
+        huffmanCodes[static_cast<unsigned char>(current.data)] = {bits, static_cast<uint8_t>(length)};
+        return true;
+    }
+    if (length == 64) {
+        return false;
+    }
+    // Recursively traverse left (append 0) and right (append 1).
+    return generateCodes(current.left, bits << 1, length + 1) &&
+           generateCodes(current.right, (bits << 1) | 1, length + 1);
+}
+
+void HuffmanCoder::writeHeader(std::ostream& outputFile) {
+    PhaseTimer timer(stats, kPhaseHeader);
+    // The header contains the frequency map, which is needed for decompression.
+    // It is assembled in one buffer and written with a single call.
+    uint64_t mapSize = 0;
+    for (uint64_t frequency : frequencies) {
+        if (frequency) mapSize++;
+    }
+    char header[sizeof(mapSize) + 256 * (sizeof(char) + sizeof(unsigned))];
+    size_t length = 0;
+    std::memcpy(header, &mapSize, sizeof(mapSize));
+    length += sizeof(mapSize);
+
+    // Append the character-frequency pairs, in signed-char order.
+    for (int character = -128; character < 128; ++character) {
+        uint64_t frequency = frequencies[static_cast<unsigned char>(character)];
+        if (frequency) {
+            char symbol = static_cast<char>(character);
+            unsigned count = static_cast<unsigned>(frequency);
+            header[length++] = symbol;
+            std::memcpy(header + length, &count, sizeof(count));
+            length += sizeof(count);
+        }
+    }
+    outputFile.write(header, static_cast<std::streamsize>(length));
+    countBytes(kPhaseHeader, 0, length);
+}
+
+// Size in bits of the counted data under the current codes.
+uint64_t HuffmanCoder::codedBits() const {
+    uint64_t bits = 0;
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        bits += frequencies[symbol] * huffmanCodes[symbol].length;
+    }
+    return bits;
+}
+
+void HuffmanCoder::writeCompressedData(const unsigned char* data, size_t size, std::ostream& output) {
+    PhaseTimer timer(stats, kPhaseData);
+    // Codes are packed 64 bits at a time into a 1 MiB buffer, which is handed
+    // to the stream whenever it fills. The last byte is padded with zeros.
+    const size_t flushThreshold = size_t(1) << 20;
+    std::vector<unsigned char> buffer;
+    buffer.reserve(flushThreshold + 8);
+    BitWriter writer(buffer);
+    for (size_t i = 0; i < size; ++i) {
+        const HuffmanCode& code = huffmanCodes[data[i]];
+        writer.write(code.bits, code.length);
+        if (writer.pendingBytes() >= flushThreshold) {
+            writer.drain(output);
+        }
+    }
+    writer.finish();
+    writer.drain(output);
+    uint64_t bits = codedBits();
+    stats.symbolsEncoded += size;
+    stats.bitsEncoded += bits;
+    countBytes(kPhaseData, size, (bits + 7) / 8);
+}
+
+
+// --- Canonical Code Implementation ---
+
+// Replaces the tree-derived codes with canonical codes of the same lengths.
+// Symbols are ordered by (code length, byte value) and numbered consecutively,
+// so the decoder can rebuild every code from the lengths alone.
+bool HuffmanCoder::assignCanonicalCodes() {
+    codeLengths.fill(0);
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        if (frequencies[symbol]) {
+            if (huffmanCodes[symbol].length > kMaxCodeLength) {
+                return false;
+            }
+            codeLengths[symbol] = huffmanCodes[symbol].length;
+        }
+    }
+    return codesFromLengths();
+}
+
+// Derives the canonical code of every symbol from codeLengths.
+bool HuffmanCoder::codesFromLengths() {
+    if (!buildCanonicalDecodeTable()) {
+        return false;
+    }
+
+    uint64_t code = 0;
+    int length = 0;
+    for (size_t i = 0; i < canonicalSymbolCount; ++i) {
+        unsigned char symbol = canonicalSymbols[i];
+        if (codeLengths[symbol] != length) {
+            length = codeLengths[symbol];
+            code = firstCode[length];
+        }
+        huffmanCodes[symbol] = {code, static_cast<uint8_t>(length)};
+        code++;
+    }
+    return true;
+}
+
+// Writes the code-length table. Small alphabets are stored sparsely as
+// (symbol, length) pairs; larger ones as one length byte per byte value.
+// Either way the table takes at most 257 bytes.
+void HuffmanCoder::writeCodeLengths(std::ostream& output) {
+    PhaseTimer timer(stats, kPhaseHeader);
+    size_t symbolCount = 0;
+    for (uint8_t length : codeLengths) {
+        if (length) symbolCount++;
+    }
+    output.put(static_cast<char>(symbolCount - 1));
+    if (symbolCount < 128) {
+        for (int symbol = 0; symbol < 256; ++symbol) {
+            if (codeLengths[symbol]) {
+                output.put(static_cast<char>(symbol));
+                output.put(static_cast<char>(codeLengths[symbol]));
+            }
+        }
+    } else {
+        output.write(reinterpret_cast<const char*>(codeLengths.data()), codeLengths.size());
+    }
+    countBytes(kPhaseHeader, 0, 1 + (symbolCount < 128 ? 2 * symbolCount : 256));
+}
+
+// Sets the length of every used symbol's code to its optimal (Huffman)
+// length, for the canonical formats, which keep only the lengths. Instead of
+// building a tree, the used symbols are radix sorted by frequency and the
+// lengths computed in place over the sorted counts by Moffat and
+// Katajainen's algorithm: one pass pairs the two lightest items as the
+// two-queue merge does, overwriting each merged count with its parent's
+// index; a second pass turns parent indices into internal node depths; a
+// third hands out leaf depths level by level. The original format keeps
+// buildHuffmanTree(), since its decoder rebuilds the exact tree.
+void HuffmanCoder::buildCodeLengths() {
+    PhaseTimer timer(stats, kPhaseTree);
+    std::array<uint64_t, 256> counts, countsScratch;
+    std::array<unsigned char, 256> symbols, symbolsScratch;
+    size_t n = 0;
+    uint64_t largest = 0;
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        huffmanCodes[symbol].length = 0;
+        if (frequencies[symbol]) {
+            counts[n] = frequencies[symbol];
+            symbols[n++] = static_cast<unsigned char>(symbol);
+            largest = std::max(largest, frequencies[symbol]);
+        }
+    }
+    if (n == 0) return;
+    if (n == 1) {
+        huffmanCodes[symbols[0]].length = 1;
+        return;
+    }
+
+    // LSD radix sort, a byte at a time, skipping the bytes every count has
+    // zero. Stable, so ties stay in byte value order.
+    for (int shift = 0; shift < 64 && (largest >> shift) != 0; shift += 8) {
+        std::array<uint32_t, 257> start{};
+        for (size_t i = 0; i < n; ++i) {
+            start[((counts[i] >> shift) & 0xFF) + 1]++;
+        }
+        for (int digit = 0; digit < 256; ++digit) {
+            start[digit + 1] += start[digit];
+        }
+        for (size_t i = 0; i < n; ++i) {
+            uint32_t to = start[(counts[i] >> shift) & 0xFF]++;
+            countsScratch[to] = counts[i];
+            symbolsScratch[to] = symbols[i];
+        }
+        counts.swap(countsScratch);
+        symbols.swap(symbolsScratch);
+    }
+
+    // First pass: counts[next] becomes the weight of internal node `next`,
+    // and the entries it consumes become its index.
+    uint64_t* a = counts.data();
+    size_t root = 0, leaf = 2;
+    a[0] += a[1];
+    for (size_t next = 1; next < n - 1; ++next) {
+        if (leaf >= n || a[root] < a[leaf]) {
+            a[next] = a[root];
+            a[root++] = next;
+        } else {
+            a[next] = a[leaf++];
+        }
+        if (leaf >= n || (root < next && a[root] < a[leaf])) {
+            a[next] += a[root];
+            a[root++] = next;
+        } else {
+            a[next] += a[leaf++];
+        }
+    }
+    // Second pass: internal node depths, the root (n - 2) at depth zero.
+    a[n - 2] = 0;
+    for (size_t next = n - 2; next-- > 0;) {
+        a[next] = a[a[next]] + 1;
+    }
+    // Third pass: leaf depths. Each level has `available` slots, of which
+    // internal nodes take `used`; leaves fill the rest, deepest first.
+    size_t available = 1, used = 0, depth = 0;
+    ptrdiff_t internal = static_cast<ptrdiff_t>(n) - 2, next = static_cast<ptrdiff_t>(n) - 1;
+    while (available > 0) {
+        while (internal >= 0 && a[internal] == depth) {
+            used++;
+            internal--;
+        }
+        while (available > used) {
+            a[next--] = depth;
+            available--;
+        }
+        available = 2 * used;
+        depth++;
+        used = 0;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        huffmanCodes[symbols[i]].length = static_cast<uint8_t>(counts[i]);
+    }
+}
+
+// Replaces the code lengths with the optimal ones of at most `lengthLimit`
+// bits, found by package-merge. Every symbol starts as a coin worth its
+// frequency; each round pairs up the cheapest coins of the previous list into
+// packages and merges them back with the leaves, once per allowed bit. The
+// cheapest 2n - 2 items of the last list then determine the lengths: each
+// leaf taken adds one bit to its symbol, and each package taken expands into
+// its two halves in the list before. Lists are sorted, so the items taken
+// from every list are always a prefix of it, and only the package flags need
+// keeping. Requires 2 <= symbols <= 2^lengthLimit.
+void HuffmanCoder::limitCodeLengths(int lengthLimit) {
+    std::array<unsigned char, 256> symbols;
+    size_t symbolCount = 0;
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        if (frequencies[symbol]) {
+            symbols[symbolCount++] = static_cast<unsigned char>(symbol);
+            huffmanCodes[symbol].length = 0;
+        }
+    }
+    std::stable_sort(symbols.begin(), symbols.begin() + symbolCount,
+                     [this](unsigned char l, unsigned char r) { return frequencies[l] < frequencies[r]; });
+
+    std::vector<uint64_t> leaves(symbolCount);
+    for (size_t i = 0; i < symbolCount; ++i) {
+        leaves[i] = frequencies[symbols[i]];
+    }
+    std::vector<std::vector<char>> isPackage(static_cast<size_t>(lengthLimit));
+    isPackage[0].assign(symbolCount, 0);
+    std::vector<uint64_t> list = leaves, merged;
+    for (int level = 1; level < lengthLimit; ++level) {
+        size_t packageCount = list.size() / 2;
+        merged.clear();
+        for (size_t leaf = 0, package = 0; leaf < symbolCount || package < packageCount;) {
+            uint64_t packageWeight = package < packageCount ? list[2 * package] + list[2 * package + 1] : 0;
+            bool takeLeaf = package == packageCount || (leaf < symbolCount && leaves[leaf] <= packageWeight);
+            merged.push_back(takeLeaf ? leaves[leaf++] : packageWeight);
+            isPackage[level].push_back(takeLeaf ? 0 : 1);
+            package += takeLeaf ? 0 : 1;
+        }
+        list.swap(merged);
+    }
+
+    size_t taken = 2 * symbolCount - 2;
+    for (int level = lengthLimit - 1; level >= 0; --level) {
+        size_t leavesTaken = 0;
+        size_t packagesTaken = 0;
+        for (size_t i = 0; i < taken; ++i) {
+            (isPackage[level][i] ? packagesTaken : leavesTaken)++;
+        }
+        for (size_t i = 0; i < leavesTaken; ++i) {
+            huffmanCodes[symbols[i]].length++;
+        }
+        taken = 2 * packagesTaken;
+    }
+}
+
+// Counts `data`, computes its code lengths and assigns canonical codes.
+// With a non-zero `lengthLimit`, lengths beyond it are replaced by optimal
+// length-limited ones, and the bits this costs are tallied.
+bool HuffmanCoder::buildCanonicalCodes(const unsigned char* data, size_t size, int lengthLimit) {
+    buildFrequencyTable(data, size);
+    return buildCanonicalCodes(lengthLimit);
+}
+
+// Builds canonical codes from the current frequencies.
+bool HuffmanCoder::buildCanonicalCodes(int lengthLimit) {
+    buildCodeLengths();
+    PhaseTimer timer(stats, kPhaseCodes);
+    if (lengthLimit) {
+        bool exceeds = false;
+        for (int symbol = 0; symbol < 256; ++symbol) {
+            exceeds |= frequencies[symbol] && huffmanCodes[symbol].length > lengthLimit;
+        }
+        if (exceeds) {
+            uint64_t before = codedBits();
+            limitCodeLengths(lengthLimit);
+            cappedBits += codedBits();
+            uncappedBits += before;
+        }
+    }
+    return assignCanonicalCodes();
+}
+
+// Takes the codes of a pre-trained table.
+bool HuffmanCoder::useCodeTable(const CodeTable& table) {
+    PhaseTimer timer(stats, kPhaseCodes);
+    if (std::count(table.codeLengths.begin(), table.codeLengths.end(), 0) != 0) {
+        return false;
+    }
+    codeLengths = table.codeLengths;
+    return codesFromLengths();
+}
+
+// --- Context Modeling Implementation ---
+
+// Counts every (previous byte, byte) pair of a block. The first byte's
+// context is zero, as the decoder assumes.
+void HuffmanCoder::countContexts(const unsigned char* data, size_t size) {
+    PhaseTimer timer(stats, kPhaseFrequencyTable);
+    contextCounts.assign(size_t(256) * 256, 0);
+    unsigned previous = 0;
+    for (size_t i = 0; i < size; ++i) {
+        contextCounts[previous << 8 | data[i]]++;
+        previous = data[i];
+    }
+    countBytes(kPhaseFrequencyTable, size, 0);
+}
+
+// Groups the counted contexts so that contexts with similar statistics share
+// a code table. The largest contexts seed the groups; every context then
+// joins the group that would code it in the fewest bits, for a few rounds,
+// and finally groups are merged pairwise for as long as the table a merge
+// saves outweighs the bits it costs. Sets contextGroup and contextGroupCount.
+void HuffmanCoder::clusterContexts() {
+    PhaseTimer timer(stats, kPhaseTree);
+    using Histogram = std::array<double, 256>;
+    // Bits to code a histogram with its own table, estimated by its entropy,
+    // plus the bytes that table would take in the header.
+    auto cost = [](const Histogram& histogram) {
+        double total = 0, bits = 0;
+        size_t symbols = 0;
+        for (double count : histogram) {
+            if (count == 0) continue;
+            total += count;
+            bits -= count * std::log2(count);
+            symbols++;
+        }
+        if (symbols == 0) return 0.0;
+        return bits + total * std::log2(total) + 8.0 * (1 + (symbols < 128 ? 2 * symbols : 256));
+    };
+
+    std::vector<unsigned> contexts;
+    std::array<uint64_t, 256> totals{};
+    for (unsigned context = 0; context < 256; ++context) {
+        const uint32_t* counts = contextCounts.data() + (size_t(context) << 8);
+        for (int symbol = 0; symbol < 256; ++symbol) {
+            totals[context] += counts[symbol];
+        }
+        if (totals[context]) contexts.push_back(context);
+    }
+    std::stable_sort(contexts.begin(), contexts.end(),
+                     [&](unsigned l, unsigned r) { return totals[l] > totals[r]; });
+
+    contextGroup.fill(0);
+    size_t groups = std::min<size_t>(contexts.size(), kMaxContextGroups);
+    std::vector<Histogram> histograms(groups);
+    for (size_t group = 0; group < groups; ++group) {
+        const uint32_t* counts = contextCounts.data() + (size_t(contexts[group]) << 8);
+        std::copy(counts, counts + 256, histograms[group].begin());
+        contextGroup[contexts[group]] = static_cast<uint8_t>(group);
+    }
+
+    // Refine: assign every context to its cheapest group, then recount. Bits
+    // per symbol are smoothed so symbols a group lacks cost a lot, not infinity.
+    std::vector<Histogram> bits(groups);
+    for (int round = 0; round < 3 && contexts.size() > groups; ++round) {
+        for (size_t group = 0; group < groups; ++group) {
+            double total = 0;
+            for (double count : histograms[group]) total += count;
+            for (int symbol = 0; symbol < 256; ++symbol) {
+                bits[group][symbol] = std::log2((total + 128) / (histograms[group][symbol] + 0.5));
+            }
+        }
+        for (unsigned context : contexts) {
+            const uint32_t* counts = contextCounts.data() + (size_t(context) << 8);
+            double best = 0;
+            for (size_t group = 0; group < groups; ++group) {
+                double contextBits = 0;
+                for (int symbol = 0; symbol < 256; ++symbol) {
+                    contextBits += counts[symbol] * bits[group][symbol];
+                }
+                if (group == 0 || contextBits < best) {
+                    best = contextBits;
+                    contextGroup[context] = static_cast<uint8_t>(group);
+                }
+            }
+        }
+        for (Histogram& histogram : histograms) histogram.fill(0);
+        for (unsigned context : contexts) {
+            const uint32_t* counts = contextCounts.data() + (size_t(context) << 8);
+            Histogram& histogram = histograms[contextGroup[context]];
+            for (int symbol = 0; symbol < 256; ++symbol) histogram[symbol] += counts[symbol];
+        }
+    }
+
+    // Merge the pair whose merge saves the most, while any saves bits.
+    std::vector<double> costs(groups);
+    for (size_t group = 0; group < groups; ++group) costs[group] = cost(histograms[group]);
+    std::vector<size_t> alias(groups);
+    for (size_t group = 0; group < groups; ++group) alias[group] = group;
+    std::vector<char> live(groups, 1);
+    std::vector<std::vector<double>> saving(groups, std::vector<double>(groups));
+    auto mergedHistogram = [&](size_t a, size_t b) {
+        Histogram merged = histograms[a];
+        for (int symbol = 0; symbol < 256; ++symbol) merged[symbol] += histograms[b][symbol];
+        return merged;
+    };
+    for (size_t a = 0; a < groups; ++a) {
+        for (size_t b = a + 1; b < groups; ++b) {
+            saving[a][b] = costs[a] + costs[b] - cost(mergedHistogram(a, b));
+        }
+    }
+    for (;;) {
+        size_t bestA = 0, bestB = 0;
+        double best = 0;
+        for (size_t a = 0; a < groups; ++a) {
+            for (size_t b = a + 1; live[a] && b < groups; ++b) {
+                if (live[b] && saving[a][b] > best) {
+                    best = saving[a][b];
+                    bestA = a;
+                    bestB = b;
+                }
+            }
+        }
+        if (best <= 0) break;
+        histograms[bestA] = mergedHistogram(bestA, bestB);
+        costs[bestA] = cost(histograms[bestA]);
+        live[bestB] = 0;
+        alias[bestB] = bestA;
+        for (size_t other = 0; other < groups; ++other) {
+            if (!live[other] || other == bestA) continue;
+            size_t a = std::min(bestA, other), b = std::max(bestA, other);
+            saving[a][b] = costs[a] + costs[b] - cost(mergedHistogram(a, b));
+        }
+    }
+
+    // Number the groups that still have contexts densely.
+    for (unsigned context : contexts) {
+        size_t group = contextGroup[context];
+        while (alias[group] != group) group = alias[group];
+        contextGroup[context] = static_cast<uint8_t>(group);
+    }
+    std::vector<int> number(groups, -1);
+    contextGroupCount = 0;
+    for (unsigned context : contexts) {
+        if (number[contextGroup[context]] < 0) number[contextGroup[context]] = int(contextGroupCount++);
+        contextGroup[context] = static_cast<uint8_t>(number[contextGroup[context]]);
+    }
+    contextGroupCount = std::max<size_t>(contextGroupCount, 1);
+}
+
+// Codes a block with order-1 context tables into `block`, if that comes out
+// smaller than the order-0 estimate and than storing the block. Returns false,
+// with the block's order-0 frequencies restored, otherwise.
+bool HuffmanCoder::encodeContextBlock(const unsigned char* data, size_t size, const CompressionOptions& options,
+                                      uint8_t flag, uint32_t checksum, std::string& block) {
+    // The order-0 alternative, estimated as in worthCoding().
+    std::array<uint64_t, 256> blockFrequencies = frequencies;
+    double order0Bits = 0;
+    size_t symbolCount = 0;
+    for (uint64_t frequency : frequencies) {
+        if (!frequency) continue;
+        symbolCount++;
+        order0Bits += double(frequency) * std::log2(double(size) / double(frequency));
+    }
+    order0Bits += 8.0 * (1 + (symbolCount < 128 ? 2 * symbolCount : 256));
+    double limitBits = std::min(order0Bits, 8.0 * double(size - size / kMinSavingDivisor));
+
+    countContexts(data, size);
+    clusterContexts();
+
+    // Every code must resolve in one decoder lookup.
+    int lengthLimit = options.maxCodeLength ? std::min(options.maxCodeLength, int(kLookupBits)) : kLookupBits;
+    std::ostringstream tables;
+    tables.put(static_cast<char>(contextGroupCount - 1));
+    if (contextGroupCount > 1) {
+        for (int context = 0; context < 256; context += 2) {
+            tables.put(static_cast<char>(contextGroup[context] | contextGroup[context + 1] << 4));
+        }
+    }
+    groupCodes.resize(contextGroupCount);
+    uint64_t payloadBits = 0;
+    for (size_t group = 0; group < contextGroupCount; ++group) {
+        frequencies.fill(0);
+        for (int context = 0; context < 256; ++context) {
+            if (contextGroup[context] != group) continue;
+            const uint32_t* counts = contextCounts.data() + (size_t(context) << 8);
+            for (int symbol = 0; symbol < 256; ++symbol) frequencies[symbol] += counts[symbol];
+        }
+        if (!buildCanonicalCodes(lengthLimit)) {
+            frequencies = blockFrequencies;
+            return false;
+        }
+        payloadBits += codedBits();
+        groupCodes[group] = huffmanCodes;
+        writeCodeLengths(tables);
+    }
+    std::string header = tables.str();
+    if (double(payloadBits) + 8.0 * header.size() >= limitBits) {
+        frequencies = blockFrequencies;
+        return false;
+    }
+
+    std::vector<unsigned char> payload;
+    {
+        PhaseTimer timer(stats, kPhaseData);
+        payload.reserve(static_cast<size_t>(payloadBits / 8) + 8);
+        BitWriter writer(payload);
+        unsigned previous = 0;
+        for (size_t i = 0; i < size; ++i) {
+            const HuffmanCode& code = groupCodes[contextGroup[previous]][data[i]];
+            writer.write(code.bits, code.length);
+            previous = data[i];
+        }
+        writer.finish();
+        stats.blocks++;
+        stats.contextBlocks++;
+        stats.symbolsEncoded += size;
+        stats.bitsEncoded += payloadBits;
+        countBytes(kPhaseData, size, payload.size());
+    }
+
+    std::ostringstream output;
+    output.put(static_cast<char>(kBlockContext | flag));
+    writeVarint(output, size);
+    writeVarint(output, payload.size());
+    if (flag) writeUint32(output, checksum);
+    block = output.str();
+    block += header;
+    block.append(reinterpret_cast<const char*>(payload.data()), payload.size());
+    frequencies = blockFrequencies;
+    return true;
+}
+
+// --- Small Alphabet Implementation ---
+
+// Codes a counted block of at most kMaxSmallAlphabet distinct byte values
+// without a code table: one value becomes a run block, two to four become a
+// small alphabet block of fixed-width indices. Those cost at most what
+// Huffman codes would plus 1/kMinSavingDivisor of the block (with a table of
+// its own, the entropy bound plus the table; with a shared one, its exact
+// size), and decode at memory speed instead of one code at a time. Returns
+// false, writing nothing, if the block has more values, Huffman coding is
+// clearly smaller, or the result would not beat storing the block.
+bool HuffmanCoder::encodeSmallAlphabet(const unsigned char* data, size_t size, bool shared, uint8_t flag,
+                                       uint32_t checksum, std::string& block) {
+    std::array<unsigned char, kMaxSmallAlphabet> symbols{};
+    size_t symbolCount = 0;
+    double huffmanBits = 0;
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        uint64_t frequency = frequencies[symbol];
+        if (!frequency) continue;
+        if (symbolCount == kMaxSmallAlphabet) return false;
+        symbols[symbolCount++] = static_cast<unsigned char>(symbol);
+        huffmanBits += shared ? double(frequency) * huffmanCodes[symbol].length
+                              : double(frequency) * std::log2(double(size) / double(frequency));
+    }
+    if (symbolCount == 0) return false;
+
+    std::vector<unsigned char> payload;
+    uint8_t type = kBlockRun;
+    if (symbolCount == 1) {
+        payload.push_back(symbols[0]);
+    } else {
+        type = kBlockSmallAlphabet;
+        int width = symbolCount == 2 ? 1 : 2;
+        size_t perByte = size_t(8 / width);
+        size_t packedBytes = (size + perByte - 1) / perByte;
+        if (!shared) {
+            huffmanBits += 8.0 * (1 + 2 * symbolCount);
+        }
+        if (8.0 * double(1 + symbolCount + packedBytes) > huffmanBits + 8.0 * double(size / kMinSavingDivisor)) {
+            return false;
+        }
+        PhaseTimer timer(stats, kPhaseData);
+        std::array<uint8_t, 256> index{};
+        for (size_t i = 0; i < symbolCount; ++i) {
+            index[symbols[i]] = static_cast<uint8_t>(i);
+        }
+        payload.reserve(1 + symbolCount + packedBytes);
+        payload.push_back(static_cast<unsigned char>(symbolCount));
+        payload.insert(payload.end(), symbols.begin(), symbols.begin() + symbolCount);
+        for (size_t i = 0; i < size; i += perByte) {
+            unsigned packed = 0;
+            for (size_t j = 0; j < perByte; ++j) {
+                packed = packed << width | (i + j < size ? index[data[i + j]] : 0u);
+            }
+            payload.push_back(static_cast<unsigned char>(packed));
+        }
+        stats.symbolsEncoded += size;
+        stats.bitsEncoded += uint64_t(size) * width;
+        countBytes(kPhaseData, size, payload.size());
+    }
+    if (payload.size() >= size - size / kMinSavingDivisor) return false;
+
+    std::ostringstream output;
+    output.put(static_cast<char>(type | flag));
+    writeVarint(output, size);
+    writeVarint(output, payload.size());
+    if (flag) writeUint32(output, checksum);
+    block = output.str();
+    block.append(reinterpret_cast<const char*>(payload.data()), payload.size());
+    stats.blocks++;
+    stats.smallAlphabetBlocks++;
+    return true;
+}
+
+// --- Block Compression Implementation ---
+
+// Whether Huffman coding the counted block saves enough over storing it.
+// With a shared or pre-trained table the coded size is known exactly;
+// otherwise the entropy of the counts bounds it from below, since Huffman
+// codes can only do worse, plus the code lengths the block would store. The
+// estimate needs only the frequency table, so a block that ends up stored
+// never builds a tree.
+bool HuffmanCoder::worthCoding(size_t size, bool shared) const {
+    double bits = 0;
+    size_t symbolCount = 0;
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        uint64_t frequency = frequencies[symbol];
+        if (!frequency) continue;
+        symbolCount++;
+        bits += shared ? double(frequency) * huffmanCodes[symbol].length
+                       : double(frequency) * std::log2(double(size) / double(frequency));
+    }
+    if (!shared) {
+        bits += 8.0 * (1 + (symbolCount < 128 ? 2 * symbolCount : 256));
+    }
+    return bits / 8 < double(size - size / kMinSavingDivisor);
+}
+
+// Fills the bulk encoder's table from the current codes, if the bytes of the
+// counted block all have codes short enough for it.
+bool HuffmanCoder::bulkCodeTable(std::array<uint32_t, 256>& table) const {
+    table.fill(0);
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        if (!frequencies[symbol]) continue;
+        const HuffmanCode& code = huffmanCodes[symbol];
+        if (code.length == 0 || code.length > kBulkMaxCodeLength) return false;
+        table[symbol] = bulkCodeEntry(code.bits, code.length);
+    }
+    return true;
+}
+
+// Whether the block's just-built codes should give way to `previousTable`:
+// it must have a code for every byte the block holds, and code the block in
+// no more bits than the fresh codes plus the code lengths they would store.
+// If so, switches the codes to it. A repeated table also spares the decoder
+// rebuilding its lookup table.
+bool HuffmanCoder::repeatsTable(const std::array<uint8_t, 256>& previousTable) {
+    PhaseTimer timer(stats, kPhaseCodes);
+    uint64_t previousBits = 0;
+    size_t symbolCount = 0;
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        if (!frequencies[symbol]) continue;
+        if (!previousTable[symbol]) return false;
+        previousBits += frequencies[symbol] * previousTable[symbol];
+        symbolCount++;
+    }
+    uint64_t headerBits = 8 * (1 + (symbolCount < 128 ? 2 * symbolCount : 256));
+    if (previousBits > codedBits() + headerBits) return false;
+    codeLengths = previousTable;
+    return codesFromLengths();
+}
+
+// The table a block with the current frequencies leaves in force for the
+// next one: `previousTable` if the block would repeat it, else its own codes.
+// This is the choice encodeBlock() makes, ahead of coding; the capping
+// counters are left alone, as encodeBlock() adds them when it builds the
+// codes again.
+std::array<uint8_t, 256> HuffmanCoder::tableInForce(const std::array<uint8_t, 256>* previousTable,
+                                                    int maxCodeLength) {
+    uint64_t capped = cappedBits, uncapped = uncappedBits;
+    bool built = buildCanonicalCodes(maxCodeLength);
+    cappedBits = capped;
+    uncappedBits = uncapped;
+    if (previousTable && (!built || repeatsTable(*previousTable))) return *previousTable;
+    return codeLengths;
+}
+
+// Counts a block into the frequency table and, with checksums on, computes
+// its CRC32C while the block is still in cache from counting it.
+void HuffmanCoder::countBlock(const unsigned char* data, size_t size, const CompressionOptions& options,
+                              uint32_t& checksum) {
+    buildFrequencyTable(data, size);
+    if (options.checksum) {
+        checksum = computeChecksum(0, data, size);
+    }
+}
+
+// Encodes one counted block into `block`, including its block header, with
+// `checksum` as its CRC32C if checksums are on. With a shared or pre-trained
+// table the current codes are used as-is and no code lengths are stored.
+// Otherwise the block gets its own table, unless coding it with
+// `previousTable` (the last table written, if any) comes out no larger once
+// the table is counted; it is then written as a shared block that repeats
+// that table. Blocks of up to four distinct byte values are written as run or
+// small alphabet blocks where those cost about the same. In context mode the
+// block is context coded if that pays. Blocks that would not shrink enough
+// are stored uncoded. Leaves the code lengths the block was coded with in
+// codeLengths.
+bool HuffmanCoder::encodeBlock(const unsigned char* data, size_t size, const CompressionOptions& options,
+                                const std::array<uint8_t, 256>* previousTable, uint32_t checksum,
+                                std::string& block) {
+    bool shared = options.sharedTable || options.table;
+    uint8_t flag = options.checksum ? kBlockChecksumFlag : 0;
+    if (encodeSmallAlphabet(data, size, shared, flag, checksum, block)) {
+        return true;
+    }
+    if (options.contextModel && !shared && encodeContextBlock(data, size, options, flag, checksum, block)) {
+        return true;
+    }
+    if (!worthCoding(size, shared)) {
+        std::ostringstream output;
+        output.put(static_cast<char>(kBlockStored | flag));
+        writeVarint(output, size);
+        writeVarint(output, size);
+        if (flag) writeUint32(output, checksum);
+        block = output.str();
+        block.append(reinterpret_cast<const char*>(data), size);
+        stats.blocks++;
+        stats.storedBlocks++;
+        return true;
+    }
+    if (!shared && !buildCanonicalCodes(options.maxCodeLength)) {
+        return false;
+    }
+    bool repeat = !shared && previousTable && repeatsTable(*previousTable);
+    std::vector<unsigned char> payload;
+    std::ostringstream streamSizes;
+    {
+        PhaseTimer timer(stats, kPhaseData);
+        std::array<uint32_t, 256> bulkTable;
+        bool bulk = bulkCodeTable(bulkTable);
+        if (options.streams == kInterleavedStreams) {
+            std::array<std::vector<unsigned char>, kInterleavedStreams> streams;
+            if (bulk) {
+                // Each stream's bytes are gathered first, so the bulk kernel
+                // codes every stream in one pass.
+                std::vector<unsigned char> gathered(size);
+                unsigned char* lanes[kInterleavedStreams];
+                size_t laneSizes[kInterleavedStreams];
+                size_t offset = 0;
+                for (int stream = 0; stream < kInterleavedStreams; ++stream) {
+                    laneSizes[stream] = (size + kInterleavedStreams - 1 - stream) / kInterleavedStreams;
+                    lanes[stream] = gathered.data() + offset;
+                    offset += laneSizes[stream];
+                }
+                size_t i = 0;
+                for (; i + kInterleavedStreams <= size; i += kInterleavedStreams) {
+                    for (int stream = 0; stream < kInterleavedStreams; ++stream) {
+                        lanes[stream][i / kInterleavedStreams] = data[i + stream];
+                    }
+                }
+                for (; i < size; ++i) {
+                    lanes[i % kInterleavedStreams][i / kInterleavedStreams] = data[i];
+                }
+                for (int stream = 0; stream < kInterleavedStreams; ++stream) {
+                    streams[stream].resize(laneSizes[stream] + kBulkOutputSlack);
+                    uint64_t bits = bulkEncode(lanes[stream], laneSizes[stream], bulkTable.data(), streams[stream].data());
+                    streams[stream].resize((bits + 7) / 8);
+                }
+            } else {
+                for (auto& stream : streams) {
+                    stream.reserve(size / 8 + 64);
+                }
+                BitWriter writers[kInterleavedStreams] = {BitWriter(streams[0]), BitWriter(streams[1]),
+                                                         BitWriter(streams[2]), BitWriter(streams[3])};
+                // Whole rounds first, so every writer is addressed by a constant index.
+                size_t i = 0;
+                for (; i + kInterleavedStreams <= size; i += kInterleavedStreams) {
+                    for (int stream = 0; stream < kInterleavedStreams; ++stream) {
+                        const HuffmanCode& code = huffmanCodes[data[i + stream]];
+                        writers[stream].write(code.bits, code.length);
+                    }
+                }
+                for (; i < size; ++i) {
+                    const HuffmanCode& code = huffmanCodes[data[i]];
+                    writers[i % kInterleavedStreams].write(code.bits, code.length);
+                }
+                for (auto& writer : writers) {
+                    writer.finish();
+                }
+            }
+            for (int stream = 0; stream + 1 < kInterleavedStreams; ++stream) {
+                writeVarint(streamSizes, streams[stream].size());
+            }
+            const std::string sizes = streamSizes.str();
+            payload.assign(sizes.begin(), sizes.end());
+            for (const auto& stream : streams) {
+                payload.insert(payload.end(), stream.begin(), stream.end());
+            }
+        } else if (bulk) {
+            payload.resize(size + kBulkOutputSlack);
+            payload.resize((bulkEncode(data, size, bulkTable.data(), payload.data()) + 7) / 8);
+        } else {
+            payload.reserve(size / 2 + 64);
+            BitWriter writer(payload);
+            for (size_t i = 0; i < size; ++i) {
+                const HuffmanCode& code = huffmanCodes[data[i]];
+                writer.write(code.bits, code.length);
+            }
+            writer.finish();
+        }
+        stats.blocks++;
+        stats.symbolsEncoded += size;
+        stats.bitsEncoded += codedBits();
+        countBytes(kPhaseData, size, payload.size());
+    }
+
+    uint8_t type;
+    if (options.streams == kInterleavedStreams) {
+        type = shared || repeat ? kBlockSharedInterleaved : kBlockHuffmanInterleaved;
+    } else {
+        type = shared || repeat ? kBlockShared : kBlockHuffman;
+    }
+    stats.repeatedTables += repeat;
+    std::ostringstream output;
+    output.put(static_cast<char>(type | flag));
+    writeVarint(output, size);
+    writeVarint(output, payload.size());
+    if (flag) writeUint32(output, checksum);
+    if (hasOwnTable(type)) {
+        writeCodeLengths(output);
+    }
+    block = output.str();
+    block.append(reinterpret_cast<const char*>(payload.data()), payload.size());
+    return true;
+}
+
+// Writes the canonical container. Blocks come from `nextBlock` and are coded
+// independently, `threads` at a time, each lane with its own coding state,
+// then written out in order. Only a fixed number of blocks is in flight, so
+// memory stays bounded however large the input is. Nothing is written for an
+// empty input.
+bool HuffmanCoder::compressBlocks(std::ostream& output, const CompressionOptions& options,
+                                   const InputSource* wholeInput, const BlockSource& nextBlock,
+                                   bool writeIndex) {
+    unsigned threads = resolveThreads(options.threads);
+    prepareWorkers(2 * threads);
+
+    // Original size and total bytes of every block, for the trailing index.
+    std::vector<std::pair<uint64_t, uint64_t>> index;
+    uint64_t written = 0;
+    auto emit = [&](const std::string& block, uint64_t originalSize) {
+        if (written == 0) {
+            output.write(kFormatMagic, sizeof(kFormatMagic));
+            output.put(static_cast<char>(kFormatVersion));
+            written = kFileHeaderSize;
+        }
+        output.write(block.data(), block.size());
+        written += block.size();
+        index.emplace_back(originalSize, block.size());
+    };
+
+    if (options.table) {
+        // Trained tables cover every byte value, so any block can use them.
+        if (!useCodeTable(*options.table)) {
+            return false;
+        }
+        std::ostringstream record;
+        record.put(static_cast<char>(kBlockDictionary));
+        writeUint32(record, options.table->id);
+        emit(record.str(), 0);
+        for (auto& worker : workers) {
+            worker.huffmanCodes = huffmanCodes;
+        }
+    } else if (options.sharedTable) {
+        *progress << "Building shared table..." << std::endl;
+        if (!wholeInput || !buildCanonicalCodes(wholeInput->data(), wholeInput->size(), options.maxCodeLength)) {
+            return false;
+        }
+        std::ostringstream table;
+        table.put(static_cast<char>(kBlockTable));
+        writeCodeLengths(table);
+        emit(table.str(), 0);
+        for (auto& worker : workers) {
+            worker.huffmanCodes = huffmanCodes;
+        }
+    }
+
+    *progress << "Compressing blocks on " << threads << " thread(s)..." << std::endl;
+    // One slot per block in flight. A slot passes from the reader to a lane's
+    // counter and then its encoder, and on to the writer, which hands it back
+    // to the reader; only the stage holding a slot touches it.
+    struct Slot {
+        const unsigned char* data = nullptr;
+        size_t size = 0;
+        size_t sequence = 0;
+        std::array<uint64_t, 256> frequencies{};
+        uint32_t checksum = 0;
+        // The table the block was offered to repeat, and the one it was coded with.
+        std::array<uint8_t, 256> offered{};
+        bool hasOffered = false;
+        std::array<uint8_t, 256> table{};
+        std::string encoded;
+        bool succeeded = false;
+    };
+    size_t lanes = threads;
+    std::vector<Slot> slots(2 * lanes + 2);
+
+    // The last table written, which a block may repeat. Each block is
+    // offered the table the block before it left in force: its own codes,
+    // or the table it repeats in turn. That choice needs only the block's
+    // counts, so the lanes make it in block order, each waiting for the
+    // previous block's choice, before coding in parallel; the output is then
+    // the same for any number of threads. A block that repeats a table which
+    // is no longer the last one written, say after a stored block, gets it
+    // written back first.
+    bool ownTables = !options.sharedTable && !options.table;
+    std::array<uint8_t, 256> lastTable{};
+    std::vector<std::array<uint8_t, 256>> tableChain(slots.size());
+    size_t chainLength = 0;
+    std::mutex chainMutex;
+    std::condition_variable chainChanged;
+    auto coded = [](const Slot& slot) { return static_cast<uint8_t>(slot.encoded[0]) & ~kBlockChecksumFlag; };
+    auto repeats = [](uint8_t type) { return type == kBlockShared || type == kBlockSharedInterleaved; };
+
+    uint32_t streamChecksum = 0;
+    size_t storedBlocks = 0;
+    auto write = [&](const Slot& slot) {
+        uint8_t type = coded(slot);
+        storedBlocks += type == kBlockStored;
+        if (ownTables && (hasOwnTable(type) || (repeats(type) && lastTable != slot.offered))) {
+            if (repeats(type)) {
+                std::ostringstream table;
+                table.put(static_cast<char>(kBlockTable));
+                codeLengths = slot.offered;
+                writeCodeLengths(table);
+                emit(table.str(), 0);
+            }
+            lastTable = slot.table;
+        }
+        streamChecksum = crc32cCombine(streamChecksum, slot.checksum, slot.size);
+        emit(slot.encoded, slot.size);
+    };
+
+    // The first two blocks are read up front, so an input of one block is
+    // coded right here without starting the pipeline.
+    size_t prefetched = 0;
+    while (prefetched < 2 && nextBlock(prefetched, slots[prefetched].data, slots[prefetched].size)) {
+        prefetched++;
+    }
+    if (prefetched == 1) {
+        Slot& slot = slots[0];
+        workers[0].countBlock(slot.data, slot.size, options, slot.checksum);
+        if (!workers[0].encodeBlock(slot.data, slot.size, options, nullptr, slot.checksum, slot.encoded)) {
+            return false;
+        }
+        write(slot);
+    } else if (prefetched == 2) {
+        // The pipeline: a reader, a counter and an encoder per lane, and
+        // this thread as the writer, joined by rings of slot numbers. Blocks
+        // are dealt to the lanes in turn, which is also the order the writer
+        // collects them in, so every ring has one producer and one consumer.
+        // Reading, counting, coding and writing then all overlap.
+        constexpr size_t kEndOfInput = SIZE_MAX;
+        std::atomic<bool> stop(false);
+        auto makeRings = [&] {
+            std::vector<std::unique_ptr<SlotRing>> rings;
+            for (size_t lane = 0; lane < lanes; ++lane) {
+                rings.push_back(std::make_unique<SlotRing>(slots.size()));
+            }
+            return rings;
+        };
+        SlotRing freeSlots(slots.size());
+        std::vector<std::unique_ptr<SlotRing>> toCount = makeRings(), toEncode = makeRings(), toWrite = makeRings();
+        for (size_t slot = prefetched; slot < slots.size(); ++slot) {
+            freeSlots.push(slot, stop);
+        }
+
+        std::vector<std::thread> stages;
+        stages.emplace_back([&] {
+            size_t sequence = 0;
+            for (; sequence < prefetched; ++sequence) {
+                slots[sequence].sequence = sequence;
+                if (!toCount[sequence % lanes]->push(sequence, stop)) return;
+            }
+            for (size_t slot;; ++sequence) {
+                if (!freeSlots.pop(slot, stop)) return;
+                if (!nextBlock(slot, slots[slot].data, slots[slot].size)) break;
+                slots[slot].sequence = sequence;
+                if (!toCount[sequence % lanes]->push(slot, stop)) return;
+            }
+            for (size_t lane = 0; lane < lanes; ++lane) {
+                if (!toCount[lane]->push(kEndOfInput, stop)) return;
+            }
+        });
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            stages.emplace_back([&, lane] {
+                HuffmanCoder& counter = workers[2 * lane];
+                for (size_t slot; toCount[lane]->pop(slot, stop);) {
+                    if (slot != kEndOfInput) {
+                        Slot& block = slots[slot];
+                        counter.countBlock(block.data, block.size, options, block.checksum);
+                        block.frequencies = counter.frequencies;
+                    }
+                    if (!toEncode[lane]->push(slot, stop) || slot == kEndOfInput) return;
+                }
+            });
+            stages.emplace_back([&, lane] {
+                HuffmanCoder& coder = workers[2 * lane + 1];
+                for (size_t slot; toEncode[lane]->pop(slot, stop);) {
+                    if (slot != kEndOfInput) {
+                        Slot& block = slots[slot];
+                        coder.frequencies = block.frequencies;
+                        if (ownTables) {
+                            std::unique_lock<std::mutex> lock(chainMutex);
+                            chainChanged.wait(lock, [&] { return chainLength == block.sequence || stop; });
+                            if (stop) return;
+                            block.hasOffered = block.sequence > 0;
+                            block.offered = tableChain[(block.sequence + slots.size() - 1) % slots.size()];
+                            lock.unlock();
+                            std::array<uint8_t, 256> next = coder.tableInForce(
+                                block.hasOffered ? &block.offered : nullptr, options.maxCodeLength);
+                            lock.lock();
+                            tableChain[block.sequence % slots.size()] = next;
+                            chainLength++;
+                            chainChanged.notify_all();
+                        }
+                        block.succeeded =
+                            coder.encodeBlock(block.data, block.size, options,
+                                              block.hasOffered ? &block.offered : nullptr, block.checksum,
+                                              block.encoded);
+                        block.table = coder.codeLengths;
+                    }
+                    if (!toWrite[lane]->push(slot, stop) || slot == kEndOfInput) return;
+                }
+            });
+        }
+
+        bool succeeded = true;
+        for (size_t sequence = 0;; ++sequence) {
+            size_t slot;
+            if (!toWrite[sequence % lanes]->pop(slot, stop) || slot == kEndOfInput) break;
+            if (!slots[slot].succeeded) {
+                succeeded = false;
+                break;
+            }
+            write(slots[slot]);
+            output.flush();
+            freeSlots.push(slot, stop);
+        }
+        stop = true;
+        {
+            std::lock_guard<std::mutex> lock(chainMutex);
+            chainChanged.notify_all();
+        }
+        freeSlots.wake();
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            toCount[lane]->wake();
+            toEncode[lane]->wake();
+            toWrite[lane]->wake();
+        }
+        for (std::thread& stage : stages) {
+            stage.join();
+        }
+        if (!succeeded) {
+            return false;
+        }
+    }
+    for (const auto& worker : workers) {
+        addWorkerStats(worker);
+    }
+    if (written == 0) {
+        return true;
+    }
+    if (storedBlocks) {
+        *progress << "Stored " << storedBlocks << " incompressible block(s) uncoded." << std::endl;
+    }
+    if (options.checksum) {
+        std::ostringstream record;
+        record.put(static_cast<char>(kBlockStreamChecksum));
+        writeUint32(record, streamChecksum);
+        emit(record.str(), 0);
+    }
+    output.put(static_cast<char>(kBlockEnd));
+
+    // A single block is found without an index, and small outputs stay small.
+    size_t dataBlocks = std::count_if(index.begin(), index.end(), [](const auto& entry) { return entry.first > 0; });
+    if (writeIndex && dataBlocks > 1) {
+        uint64_t indexOffset = written + 1;
+        writeVarint(output, index.size());
+        for (const auto& entry : index) {
+            writeVarint(output, entry.first);
+            writeVarint(output, entry.second);
+        }
+        unsigned char footer[8];
+        for (int i = 0; i < 8; ++i) {
+            footer[i] = static_cast<unsigned char>(indexOffset >> (8 * i));
+        }
+        output.write(reinterpret_cast<const char*>(footer), sizeof(footer));
+        output.write(kIndexMagic, sizeof(kIndexMagic));
+    }
+    output.flush();
+    return static_cast<bool>(output);
+}
+
+
+bool HuffmanCoder::compress(const std::string& inputFilePath, const std::string& outputFilePath,
+                             const CompressionOptions& options) {
+    // "-" selects stdout; progress messages then go to stderr.
+    OutputSink sink;
+    if (!sink.open(outputFilePath, options.output)) {
+        std::cerr << "Error: Could not open output file: " << outputFilePath << std::endl;
+        return false;
+    }
+    std::ostream output(&sink);
+    progress = quiet ? &nullStream : outputFilePath == "-" ? &std::cerr : &std::cout;
+    cappedBits = uncappedBits = 0;
+
+    // "-" selects stdin, which is compressed as a stream of fixed-size blocks,
+    // kDefaultStreamBlockSize unless options.blockSize is set:
+    // only one window of blocks is held in memory, and each window is written
+    // out before the next one is read.
+    if (inputFilePath == "-") {
+        if (options.sharedTable) {
+            std::cerr << "Error: --shared-table needs the whole input and cannot be used with stdin." << std::endl;
+            return false;
+        }
+        CompressionOptions streamOptions = options;
+        streamOptions.blockSize = containerBlockSize(options, kDefaultStreamBlockSize);
+        std::vector<std::vector<unsigned char>> buffers;
+        auto nextBlock = [&](size_t slot, const unsigned char*& data, size_t& size) {
+            if (slot >= buffers.size()) {
+                buffers.resize(slot + 1);
+            }
+            buffers[slot].resize(streamOptions.blockSize);
+            std::cin.read(reinterpret_cast<char*>(buffers[slot].data()), buffers[slot].size());
+            size = static_cast<size_t>(std::cin.gcount());
+            data = buffers[slot].data();
+            return size > 0;
+        };
+        if (!compressBlocks(output, streamOptions, nullptr, nextBlock, false) || !sink.close()) {
+            std::cerr << "Error: Could not compress stdin." << std::endl;
+            return false;
+        }
+        reportLengthCap(streamOptions);
+        *progress << "Compression successful!" << std::endl;
+        return true;
+    }
+
+    InputSource input;
+    if (!input.open(inputFilePath)) {
+        std::cerr << "Error: Could not open input file: " << inputFilePath << std::endl;
+        return false;
+    }
+
+    // Handle empty file as a special case.
+    if (input.size() == 0) {
+        *progress << "Input file is empty. Creating an empty compressed file." << std::endl;
+        return true;
+    }
+
+    if (!compressInput(input, output, options, outputFilePath != "-") || !sink.close()) {
+        std::cerr << "Error: Could not compress " << inputFilePath << ": Huffman codes are too long to encode "
+                  << "or the output could not be written." << std::endl;
+        return false;
+    }
+    input.close();
+
+    reportLengthCap(options);
+    *progress << "Compression successful!" << std::endl;
+    return true;
+}
+
+bool HuffmanCoder::compress(const unsigned char* data, size_t size, std::vector<unsigned char>& output,
+                            const CompressionOptions& options) {
+    progress = &nullStream;
+    cappedBits = uncappedBits = 0;
+    output.clear();
+    if (size == 0) {
+        return true;
+    }
+    InputSource input;
+    input.wrap(data, size);
+    VectorStreamBuffer buffer(output);
+    std::ostream stream(&buffer);
+    return compressInput(input, stream, options, true);
+}
+
+size_t containerBlockSize(const CompressionOptions& options, uint64_t inputSize) {
+    uint64_t blockSize = options.blockSize ? options.blockSize : inputSize;
+    return static_cast<size_t>(std::min<uint64_t>(blockSize, kMaxBlockSize));
+}
+
+// Compresses a non-empty input in the format `options` selects. The block
+// index is only written when `writeIndex` is set.
+bool HuffmanCoder::compressInput(const InputSource& input, std::ostream& output, const CompressionOptions& options,
+                                 bool writeIndex) {
+    if (options.canonical || options.blockSize || options.sharedTable || options.maxCodeLength ||
+        options.streams > 1 || options.table || options.checksum || options.contextModel) {
+        size_t blockSize = containerBlockSize(options, input.size());
+        size_t offset = 0;
+        auto nextBlock = [&](size_t, const unsigned char*& data, size_t& size) {
+            if (offset >= input.size()) return false;
+            data = input.data() + offset;
+            size = std::min(blockSize, input.size() - offset);
+            offset += size;
+            return true;
+        };
+        return compressBlocks(output, options, &input, nextBlock, writeIndex);
+    }
+
+    *progress << "Building frequency table..." << std::endl;
+    buildFrequencyTable(input.data(), input.size());
+
+    *progress << "Building Huffman tree..." << std::endl;
+    buildHuffmanTree();
+
+    *progress << "Generating Huffman codes..." << std::endl;
+    bool codesFit;
+    {
+        PhaseTimer timer(stats, kPhaseCodes);
+        codesFit = generateCodes(tree.root, 0, 0);
+    }
+    if (!codesFit) {
+        return false;
+    }
+
+    *progress << "Writing header..." << std::endl;
+    writeHeader(output);
+
+    *progress << "Writing compressed data..." << std::endl;
+    writeCompressedData(input.data(), input.size(), output);
+    output.flush();
+    return static_cast<bool>(output);
+}
+
+
+// --- Decompression Implementation ---
+
+// Number of payload bits a legacy stream with the current tree and
+// frequencies takes: the sum of every byte's frequency times its depth. The
+// walk keeps its own stack, bounded by the tree's node count.
+uint64_t HuffmanCoder::legacyPayloadBits() const {
+    std::array<std::pair<uint16_t, uint16_t>, HuffmanTree::kMaxNodes> pending;
+    size_t count = 0;
+    pending[count++] = {tree.root, 0};
+    uint64_t bits = 0;
+    while (count > 0) {
+        auto [node, depth] = pending[--count];
+        const HuffmanTree::Node& current = tree.nodes[node];
+        if (current.isLeaf()) {
+            bits += frequencies[static_cast<unsigned char>(current.data)] * depth;
+            continue;
+        }
+        for (uint16_t child : {current.left, current.right}) {
+            if (child != HuffmanTree::kNoNode) pending[count++] = {child, static_cast<uint16_t>(depth + 1)};
+        }
+    }
+    return bits;
+}
+
+// Reads the frequency map of an original-format header. The writer lists
+// every byte value at most once, so a map of more than 256 entries, one that
+// runs past the input, or one that lists a byte twice is rejected before
+// anything is built from it; a hostile header costs at most 256 steps.
+bool HuffmanCoder::readHeader(ByteCursor& cursor) {
+    PhaseTimer timer(stats, kPhaseHeader);
+    size_t start = cursor.pos;
+    frequencies.fill(0);
+    uint64_t mapSize = 0;
+    for (int i = 0; i < 8; ++i) {
+        uint8_t byte;
+        if (!cursor.get(byte)) return false;
+        mapSize |= uint64_t(byte) << (8 * i);
+    }
+    constexpr size_t kEntryBytes = 1 + sizeof(unsigned);
+    if (mapSize > 256 || cursor.remaining() < mapSize * kEntryBytes) return false;
+
+    // Reconstruct the frequency map by reading from the header.
+    std::array<bool, 256> listed{};
+    for (uint64_t i = 0; i < mapSize; ++i) {
+        unsigned char character = cursor.data[cursor.pos];
+        unsigned frequency;
+        std::memcpy(&frequency, cursor.data + cursor.pos + 1, sizeof(frequency));
+        cursor.skip(kEntryBytes);
+        if (listed[character]) return false;
+        listed[character] = true;
+        frequencies[character] = frequency;
+    }
+    countBytes(kPhaseHeader, cursor.pos - start, 0);
+    return true;
+}
+
+void HuffmanCoder::buildDecodeTable(uint16_t node, uint32_t code, int length) {
+    if (node == HuffmanTree::kNoNode) {
+        return;
+    }
+    const HuffmanTree::Node& current = tree.nodes[node];
+    bool isLeaf = current.isLeaf();
+    // Stop at a leaf, or once the code prefix fills the lookup window.
+    if (isLeaf || length == kLookupBits) {
+        // Every slot whose top `length` bits equal `code` resolves to this node.
+        uint32_t first = code << (kLookupBits - length);
+        uint32_t count = 1u << (kLookupBits - length);
+        DecodeEntry entry;
+        entry.length = static_cast<uint8_t>(length);
+        if (isLeaf) {
+            entry.symbol = current.data;
+        } else {
+            entry.subtree = node;
+        }
+        for (uint32_t i = 0; i < count; ++i) {
+            decodeTable[first + i] = entry;
+        }
+        return;
+    }
+    buildDecodeTable(current.left, code << 1, length + 1);
+    buildDecodeTable(current.right, (code << 1) | 1, length + 1);
+}
+
+// Decodes the next symbol from a freshly refilled reader using the current
+// decode table. Returns false on a truncated stream or a bit pattern that
+// matches no code.
+inline bool HuffmanCoder::decodeSymbol(BitReader& reader, char& symbol) const {
+    const DecodeEntry& entry = decodeTable[reader.peek(kLookupBits)];
+    if (entry.length == 0 || entry.length > reader.available()) return false;
+
+    symbol = entry.symbol;
+    if (entry.longCanonical) {
+        // Long canonical code: find the length whose code range contains
+        // the next bits, then index the symbol within that length.
+        int length = kLookupBits + 1;
+        while (length <= maxCodeLength && reader.peek(length) - firstCode[length] >= lengthCount[length]) {
+            length++;
+        }
+        if (length > maxCodeLength || length > reader.available()) return false;
+        uint64_t index = reader.peek(length) - firstCode[length];
+        symbol = static_cast<char>(canonicalSymbols[firstSymbolIndex[length] + index]);
+        reader.consume(length);
+        return true;
+    }
+    reader.consume(entry.length);
+
+    if (entry.subtree != HuffmanTree::kNoNode) {
+        // Long code: finish it by walking the tree from the table's node.
+        uint16_t node = entry.subtree;
+        while (node != HuffmanTree::kNoNode && !tree.nodes[node].isLeaf()) {
+            if (reader.available() == 0) {
+                reader.refill();
+                if (reader.available() == 0) break;
+            }
+            node = reader.peekBit() ? tree.nodes[node].right : tree.nodes[node].left;
+            reader.consume(1);
+        }
+        if (node == HuffmanTree::kNoNode || !tree.nodes[node].isLeaf()) return false;
+        symbol = tree.nodes[node].data;
+    }
+    return true;
+}
+
+// Decodes up to `count` symbols from `input`, starting at `bitPosition`, using
+// the current decode table. Advances `bitPosition` past the decoded codes and
+// returns the number of symbols decoded, which is short of `count` only if the
+// input is truncated or contains a bit pattern that matches no code.
+size_t HuffmanCoder::decodeSymbols(const unsigned char* input, size_t inputSize, uint64_t& bitPosition,
+                                    char* output, size_t count) {
+    PhaseTimer timer(stats, kPhaseDecode);
+    BitReader reader(input, inputSize, bitPosition);
+    size_t decodedCount = 0;
+    while (decodedCount < count) {
+        reader.refill();
+        if (!decodeSymbol(reader, output[decodedCount])) break;
+        decodedCount++;
+    }
+
+    stats.symbolsDecoded += decodedCount;
+    stats.bitsDecoded += reader.position() - bitPosition;
+    countBytes(kPhaseDecode, reader.position() / 8 - bitPosition / 8, decodedCount);
+    bitPosition = reader.position();
+    return decodedCount;
+}
+
+// Finds the bitstreams of an interleaved payload: the sizes of all but the
+// last are stored up front, and the last takes the remaining bytes.
+bool HuffmanCoder::splitStreams(const unsigned char* payload, size_t payloadSize,
+                                const unsigned char* (&starts)[kInterleavedStreams],
+                                size_t (&sizes)[kInterleavedStreams]) {
+    ByteCursor cursor{payload, payloadSize};
+    uint64_t sizeSum = 0;
+    for (int stream = 0; stream + 1 < kInterleavedStreams; ++stream) {
+        uint64_t size;
+        if (!cursor.readVarint(size) || size > payloadSize) return false;
+        sizes[stream] = static_cast<size_t>(size);
+        sizeSum += size;
+    }
+    if (sizeSum > cursor.remaining()) return false;
+    sizes[kInterleavedStreams - 1] = cursor.remaining() - static_cast<size_t>(sizeSum);
+    const unsigned char* start = payload + cursor.pos;
+    for (int stream = 0; stream < kInterleavedStreams; ++stream) {
+        starts[stream] = start;
+        start += sizes[stream];
+    }
+    return true;
+}
+
+// Decodes all `count` symbols of an interleaved payload. Each round decodes
+// one symbol from every stream; the streams share no state, so their table
+// lookups and shifts overlap instead of forming one long dependency chain.
+// This is the generic path for codes too long for a specialized kernel.
+bool HuffmanCoder::decodeInterleaved(const unsigned char* payload, size_t payloadSize, char* output,
+                                      size_t count) {
+    PhaseTimer timer(stats, kPhaseDecode);
+    const unsigned char* starts[kInterleavedStreams];
+    size_t sizes[kInterleavedStreams];
+    if (!splitStreams(payload, payloadSize, starts, sizes)) return false;
+    BitReader readers[kInterleavedStreams];
+    for (int stream = 0; stream < kInterleavedStreams; ++stream) {
+        readers[stream] = BitReader(starts[stream], sizes[stream]);
+    }
+    char* out = output;
+    char* end = output + count;
+
+    size_t rounds = count / kInterleavedStreams;
+    for (size_t round = 0; round < rounds; ++round, out += kInterleavedStreams) {
+        readers[0].refill();
+        readers[1].refill();
+        readers[2].refill();
+        readers[3].refill();
+        if (!decodeSymbol(readers[0], out[0]) || !decodeSymbol(readers[1], out[1]) ||
+            !decodeSymbol(readers[2], out[2]) || !decodeSymbol(readers[3], out[3])) {
+            return false;
+        }
+    }
+    for (size_t stream = 0; stream < static_cast<size_t>(end - out); ++stream) {
+        readers[stream].refill();
+        if (!decodeSymbol(readers[stream], out[stream])) return false;
+    }
+    for (const BitReader& reader : readers) {
+        stats.bitsDecoded += reader.position();
+    }
+    stats.symbolsDecoded += count;
+    countBytes(kPhaseDecode, payloadSize, count);
+    return true;
+}
+
+// --- Specialized Decode Kernels ---
+
+// Fills the 2^width slots of `table` from the canonical layout built by
+// buildCanonicalDecodeTable(). Every code must be at most `width` bits.
+void HuffmanCoder::fillLookupTable(LookupEntry* table, int width) const {
+    std::fill(table, table + (size_t(1) << width), LookupEntry());
+    for (int length = 1; length <= maxCodeLength; ++length) {
+        LookupEntry entry;
+        entry.length = static_cast<uint8_t>(length);
+        uint32_t slots = 1u << (width - length);
+        for (uint32_t i = 0; i < lengthCount[length]; ++i) {
+            entry.symbol = canonicalSymbols[firstSymbolIndex[length] + i];
+            LookupEntry* first = table + ((firstCode[length] + i) << (width - length));
+            std::fill(first, first + slots, entry);
+        }
+    }
+}
+
+// Picks the kernels for the canonical table just built and fills their
+// lookup table, or clears them if some code is longer than any kernel reads.
+void HuffmanCoder::selectDecodeKernels() {
+    static constexpr DecodeKernel kKernels[][2] = {
+        {&HuffmanCoder::decodeWithKernel<9, 1>, &HuffmanCoder::decodeWithKernel<9, kInterleavedStreams>},
+        {&HuffmanCoder::decodeWithKernel<10, 1>, &HuffmanCoder::decodeWithKernel<10, kInterleavedStreams>},
+        {&HuffmanCoder::decodeWithKernel<11, 1>, &HuffmanCoder::decodeWithKernel<11, kInterleavedStreams>},
+        {&HuffmanCoder::decodeWithKernel<12, 1>, &HuffmanCoder::decodeWithKernel<12, kInterleavedStreams>},
+    };
+    static_assert(sizeof(kKernels) / sizeof(kKernels[0]) == kMaxKernelBits - kMinKernelBits + 1,
+                  "one kernel pair per width");
+    if (maxCodeLength > kMaxKernelBits) {
+        singleStreamKernel = nullptr;
+        interleavedKernel = nullptr;
+        return;
+    }
+    int width = std::max(maxCodeLength, kMinKernelBits);
+    fillLookupTable(kernelTable.data(), width);
+    singleStreamKernel = kKernels[width - kMinKernelBits][0];
+    interleavedKernel = kKernels[width - kMinKernelBits][1];
+}
+
+// Decodes all `count` symbols of a block whose codes are at most `Width`
+// bits, from one bitstream or from `Streams` interleaved ones. One refill
+// leaves at least 56 bits in every reader, so each round takes 56 / Width
+// symbols from every stream with no bounds checks; invalid bit patterns have
+// length 0 and are caught once per round. The last few symbols of each
+// stream, where the refill falls short, are checked one by one.
+template <int Width, int Streams>
+bool HuffmanCoder::decodeWithKernel(const unsigned char* payload, size_t payloadSize, char* output, size_t count) {
+    static_assert(Width >= kMinKernelBits && Width <= kMaxKernelBits, "no lookup table of this width");
+    PhaseTimer timer(stats, kPhaseDecode);
+    BitReader readers[Streams];
+    if constexpr (Streams == 1) {
+        readers[0] = BitReader(payload, payloadSize);
+    } else {
+        static_assert(Streams == kInterleavedStreams, "interleaved blocks have a fixed stream count");
+        const unsigned char* starts[kInterleavedStreams];
+        size_t sizes[kInterleavedStreams];
+        if (!splitStreams(payload, payloadSize, starts, sizes)) return false;
+        for (int stream = 0; stream < Streams; ++stream) {
+            readers[stream] = BitReader(starts[stream], sizes[stream]);
+        }
+    }
+    constexpr int kSymbolsPerRefill = 56 / Width;
+    constexpr ptrdiff_t kRoundSymbols = Streams * kSymbolsPerRefill;
+    const LookupEntry* table = kernelTable.data();
+    char* out = output;
+    char* end = output + count;
+
+    for (; end - out >= kRoundSymbols; out += kRoundSymbols) {
+        bool enoughBits = true;
+#pragma GCC unroll 4
+        for (int stream = 0; stream < Streams; ++stream) {
+            readers[stream].refill();
+            enoughBits &= readers[stream].available() >= kSymbolsPerRefill * Width;
+        }
+        if (!enoughBits) break;
+        bool valid = true;
+#pragma GCC unroll 8
+        for (int step = 0; step < kSymbolsPerRefill; ++step) {
+#pragma GCC unroll 4
+            for (int stream = 0; stream < Streams; ++stream) {
+                const LookupEntry& entry = table[readers[stream].peek(Width)];
+                out[step * Streams + stream] = static_cast<char>(entry.symbol);
+                valid &= entry.length != 0;
+                readers[stream].consume(entry.length);
+            }
+        }
+        if (!valid) return false;
+    }
+    for (; out < end; ++out) {
+        BitReader& reader = readers[(out - output) % Streams];
+        reader.refill();
+        const LookupEntry& entry = table[reader.peek(Width)];
+        if (entry.length == 0 || entry.length > reader.available()) return false;
+        *out = static_cast<char>(entry.symbol);
+        reader.consume(entry.length);
+    }
+
+    for (const BitReader& reader : readers) {
+        stats.bitsDecoded += reader.position();
+    }
+    stats.symbolsDecoded += count;
+    countBytes(kPhaseDecode, payloadSize, count);
+    return true;
+}
+
+// Decodes a whole data block of the given type into `output`. Run blocks are
+// written by writeRunBlock() instead.
+bool HuffmanCoder::decodeBlock(uint8_t type, const unsigned char* payload, size_t payloadSize, char* output,
+                                size_t count) {
+    if (type == kBlockStored) {
+        if (payloadSize != count) return false;
+        std::copy_n(payload, count, output);
+        return true;
+    }
+    if (type == kBlockSmallAlphabet) {
+        return decodeSmallAlphabet(payload, payloadSize, output, count);
+    }
+    if (type == kBlockContext) {
+        return decodeContext(payload, payloadSize, output, count);
+    }
+    DecodeKernel kernel = isInterleaved(type) ? interleavedKernel : singleStreamKernel;
+    if (kernel) {
+        return (this->*kernel)(payload, payloadSize, output, count);
+    }
+    if (isInterleaved(type)) {
+        return decodeInterleaved(payload, payloadSize, output, count);
+    }
+    uint64_t bitPosition = 0;
+    return decodeSymbols(payload, payloadSize, bitPosition, output, count) == count;
+}
+
+// Decodes `count` symbols from the start of `input` and writes them out in
+// bounded chunks. Returns true if every symbol was decoded.
+bool HuffmanCoder::decodeToStream(const unsigned char* input, size_t inputSize, uint64_t count,
+                                   std::ostream& outputFile) {
+    std::vector<char> chunk(static_cast<size_t>(std::min<uint64_t>(count, uint64_t(1) << 20)));
+    uint64_t bitPosition = 0;
+    while (count > 0) {
+        size_t wanted = static_cast<size_t>(std::min<uint64_t>(count, chunk.size()));
+        size_t decoded = decodeSymbols(input, inputSize, bitPosition, chunk.data(), wanted);
+        outputFile.write(chunk.data(), decoded);
+        if (decoded < wanted) {
+            return false;
+        }
+        count -= decoded;
+    }
+    return true;
+}
+
+bool HuffmanCoder::decompressLegacy(const InputSource& input, std::ostream& outputFile,
+                                    const DecompressionOptions& options) {
+    ByteCursor cursor{input.data(), input.size()};
+    uint64_t totalChars = 0;
+    std::string key;
+    std::shared_ptr<const CachedTables> cached;
+    size_t headerBytes = legacyHeaderBytes(input.data(), input.size());
+    if (tableCache && headerBytes) {
+        key = tableCacheKey(kLegacyTables, input.data(), headerBytes);
+        cached = findCachedTables(key);
+    }
+    if (cached) {
+        *progress << "Using cached Huffman tree..." << std::endl;
+        restoreTables(*cached);
+        totalChars = cached->symbolCount;
+        cursor.skip(headerBytes);
+    } else {
+        *progress << "Reading header..." << std::endl;
+        if (!readHeader(cursor)) return false;
+
+        *progress << "Rebuilding Huffman tree..." << std::endl;
+        buildHuffmanTree();
+
+        // Calculate total number of characters in original file to know when to stop decoding.
+        for (uint64_t frequency : frequencies) {
+            totalChars += frequency;
+        }
+    }
+    if (totalChars == 0 || tree.root == HuffmanTree::kNoNode) return true;
+    // A payload too short for the codes the header promises is truncated or
+    // corrupt, and is rejected before decoding any of it.
+    uint64_t payloadBits = cached ? cached->payloadBits : legacyPayloadBits();
+    if (payloadBits > uint64_t(cursor.remaining()) * 8) return false;
+    const HuffmanTree::Node& root = tree.nodes[tree.root];
+    if (root.right == HuffmanTree::kNoNode && root.left != HuffmanTree::kNoNode) {
+        *progress << "Decoding data..." << std::endl;
+        return decodeLegacyRun(input.data() + cursor.pos, cursor.remaining(), totalChars,
+                               tree.nodes[root.left].data, outputFile);
+    }
+
+    if (!cached) {
+        PhaseTimer timer(stats, kPhaseDecodeTables);
+        decodeTable.fill(DecodeEntry());
+        buildDecodeTable(tree.root, 0, 0);
+        if (!key.empty()) cacheTables(std::move(key), true, totalChars, payloadBits);
+    }
+    unsigned threads = resolveThreads(options.threads);
+    if (threads > 1 && cursor.remaining() > kLegacySegmentBytes) {
+        *progress << "Decoding data on " << threads << " thread(s)..." << std::endl;
+        return decodeLegacyParallel(input.data() + cursor.pos, cursor.remaining(), totalChars, threads, outputFile);
+    }
+    *progress << "Decoding data..." << std::endl;
+    return decodeToStream(input.data() + cursor.pos, cursor.remaining(), totalChars, outputFile);
+}
+
+// Decodes a legacy stream with a single byte value. Its tree is a leaf below
+// a dummy root, so the only code is a 0 bit: the output is that byte repeated,
+// written in bounded chunks, and the payload only has to be scanned for a 1
+// bit. Like the tree walk, a corrupt stream writes the bytes before the
+// first bad bit and fails.
+bool HuffmanCoder::decodeLegacyRun(const unsigned char* input, size_t inputSize, uint64_t count, char symbol,
+                                   std::ostream& outputFile) {
+    uint64_t valid = std::min<uint64_t>(count, uint64_t(inputSize) * 8);
+    {
+        PhaseTimer timer(stats, kPhaseDecode);
+        size_t bytes = static_cast<size_t>((valid + 7) / 8);
+        size_t first = static_cast<size_t>(std::find_if(input, input + bytes, [](unsigned char byte) {
+                                               return byte != 0;
+                                           }) - input);
+        if (first < bytes) {
+            valid = std::min<uint64_t>(valid, uint64_t(first) * 8 + __builtin_clz(input[first]) - 24);
+        }
+        stats.symbolsDecoded += valid;
+        stats.bitsDecoded += valid;
+        countBytes(kPhaseDecode, valid / 8, valid);
+    }
+    writeRun(symbol, valid, outputFile);
+    return valid == count;
+}
+
+// Verifies and writes a run block, whose one payload byte stands for all
+// `count` bytes of the block. The run is never expanded in memory, so a
+// block's claimed size costs nothing until it is written, and its checksum
+// is derived from that of the single byte, so a forged one fails before any
+// of it is.
+bool HuffmanCoder::writeRunBlock(const unsigned char* payload, size_t payloadSize, uint64_t count, bool checksummed,
+                                 uint32_t stored, uint32_t& streamChecksum, std::ostream& outputFile) {
+    if (payloadSize != 1) return false;
+    uint32_t actual = checksummed ? runChecksum(payload[0], count) : 0;
+    if (!verifyBlock(checksummed, stored, actual, count, streamChecksum)) return false;
+    stats.symbolsDecoded += count;
+    countBytes(kPhaseDecode, payloadSize, count);
+    writeRun(static_cast<char>(payload[0]), count, outputFile);
+    return true;
+}
+
+// Checksum of `symbol` repeated `count` times, built by doubling: combining
+// a run's checksum with itself gives that of a run twice as long.
+uint32_t HuffmanCoder::runChecksum(unsigned char symbol, uint64_t count) {
+    PhaseTimer timer(stats, kPhaseChecksum);
+    uint32_t checksum = 0;
+    uint32_t power = crc32c(0, &symbol, 1);
+    for (uint64_t powerSize = 1; count > 0; count >>= 1, powerSize *= 2) {
+        if (count & 1) checksum = crc32cCombine(checksum, power, powerSize);
+        power = crc32cCombine(power, power, powerSize);
+    }
+    return checksum;
+}
+
+// Writes `symbol` `count` times, a bounded chunk at a time.
+void HuffmanCoder::writeRun(char symbol, uint64_t count, std::ostream& outputFile) {
+    std::vector<char> chunk(static_cast<size_t>(std::min<uint64_t>(count, uint64_t(1) << 20)), symbol);
+    for (uint64_t left = count; left > 0;) {
+        size_t wanted = static_cast<size_t>(std::min<uint64_t>(left, chunk.size()));
+        outputFile.write(chunk.data(), wanted);
+        left -= wanted;
+    }
+}
+
+// --- Parallel Legacy Decoding ---
+// A legacy payload is one bitstream, but Huffman codes resynchronise: a
+// decoder started at an arbitrary bit soon lands on a true code boundary,
+// after which its output is exactly that of a decoder started at bit 0. The
+// payload is cut into segments at byte boundaries, which also keeps codes of
+// a single length (such as 8-bit codes of random data) in step. A window of
+// segments is decoded speculatively side by side; the first starts where the
+// previous window really ended. The segments are then joined in order: the
+// true decoding has to reach one of the code starts a segment recorded, and
+// the segment's symbols from there on are taken as they are. Until then, and
+// for the whole segment if it never happens, the codes are decoded again
+// from the true position. Output and failures match decodeToStream().
+
+// Decodes codes from bit `start` until reaching bit `limit`, an invalid code,
+// or the end of the input.
+void HuffmanCoder::decodeSegment(const unsigned char* input, size_t inputSize, uint64_t start, uint64_t limit,
+                                 LegacySegment& segment) const {
+    segment.symbols.resize(static_cast<size_t>(limit > start ? limit - start : 0));
+    segment.count = 0;
+    segment.starts.clear();
+    segment.failed = false;
+    BitReader reader(input, inputSize, start);
+    while (reader.position() < limit) {
+        if (segment.starts.size() < kSyncSymbols) segment.starts.push_back(reader.position());
+        reader.refill();
+        if (!decodeSymbol(reader, segment.symbols[segment.count])) {
+            segment.failed = true;
+            break;
+        }
+        segment.count++;
+    }
+    segment.end = reader.position();
+}
+
+// Decodes `count` symbols of a legacy payload on `threads` threads, using
+// the current decode table, and writes them out one window at a time.
+bool HuffmanCoder::decodeLegacyParallel(const unsigned char* input, size_t inputSize, uint64_t count,
+                                        unsigned threads, std::ostream& outputFile) {
+    PhaseTimer timer(stats, kPhaseDecode);
+    const uint64_t totalBits = uint64_t(inputSize) * 8;
+    const uint64_t segmentBits = uint64_t(kLegacySegmentBytes) * 8;
+    size_t segmentCount = (inputSize + kLegacySegmentBytes - 1) / kLegacySegmentBytes;
+    std::vector<LegacySegment> segments(std::min(size_t(threads) * 2, segmentCount));
+    std::vector<char> resumed;
+    uint64_t position = 0;
+    uint64_t left = count;
+    bool valid = true;
+    for (size_t first = 0; first < segmentCount && left > 0 && valid; first += segments.size()) {
+        size_t batch = std::min(segments.size(), segmentCount - first);
+        parallelFor(batch, threads, [&](size_t i, unsigned) {
+            uint64_t start = i == 0 ? position : (first + i) * segmentBits;
+            decodeSegment(input, inputSize, start, std::min(totalBits, (first + i + 1) * segmentBits), segments[i]);
+        });
+
+        for (size_t i = 0; i < batch && left > 0 && valid; ++i) {
+            const LegacySegment& segment = segments[i];
+            uint64_t limit = std::min(totalBits, (first + i + 1) * segmentBits);
+            auto start = std::lower_bound(segment.starts.begin(), segment.starts.end(), position);
+            BitReader reader(input, inputSize, position);
+            bool synced = false;
+            resumed.clear();
+            while (resumed.size() < left) {
+                while (start != segment.starts.end() && *start < reader.position()) ++start;
+                if (start != segment.starts.end() && *start == reader.position()) {
+                    synced = true;
+                    break;
+                }
+                if (reader.position() >= limit) break;
+                reader.refill();
+                char symbol;
+                if (!decodeSymbol(reader, symbol)) {
+                    valid = false;
+                    break;
+                }
+                resumed.push_back(symbol);
+            }
+            outputFile.write(resumed.data(), resumed.size());
+            left -= resumed.size();
+            position = reader.position();
+            if (!synced) continue;
+
+            // From the recorded start on, the segment decoded exactly what the
+            // true decoding would, including an invalid code it ran into.
+            size_t index = static_cast<size_t>(start - segment.starts.begin());
+            size_t taken = static_cast<size_t>(std::min<uint64_t>(segment.count - index, left));
+            outputFile.write(segment.symbols.data() + index, taken);
+            left -= taken;
+            position = segment.end;
+            valid = left == 0 || !segment.failed;
+        }
+    }
+
+    stats.symbolsDecoded += count - left;
+    stats.bitsDecoded += position;
+    countBytes(kPhaseDecode, position / 8, count - left);
+    return left == 0;
+}
+
+// --- Decode Table Cache Implementation ---
+// Entries are kept most recently used first, and the index finds them by
+// key. The lock is held only to look up and move entries; the tables are
+// copied outside it. Entries never change once added, and are shared, so one
+// dropped while another thread still copies from it stays alive until then.
+struct DecodeTableCache::Impl {
+    using Entry = std::pair<std::string, std::shared_ptr<const HuffmanCoder::CachedTables>>;
+    size_t capacity = 0;
+    mutable std::mutex mutex;
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+};
+
+DecodeTableCache::DecodeTableCache(size_t capacity) : impl(std::make_unique<Impl>()) {
+    impl->capacity = capacity;
+}
+
+DecodeTableCache::~DecodeTableCache() = default;
+
+size_t DecodeTableCache::size() const {
+    std::lock_guard<std::mutex> lock(impl->mutex);
+    return impl->entries.size();
+}
+
+void DecodeTableCache::clear() {
+    std::lock_guard<std::mutex> lock(impl->mutex);
+    impl->index.clear();
+    impl->entries.clear();
+}
+
+// Looks `key` up in the table cache, marking a hit as most recently used.
+std::shared_ptr<const HuffmanCoder::CachedTables> HuffmanCoder::findCachedTables(const std::string& key) {
+    DecodeTableCache::Impl& cache = *tableCache->impl;
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    auto found = cache.index.find(key);
+    if (found == cache.index.end()) {
+        stats.tableCacheMisses++;
+        return nullptr;
+    }
+    cache.entries.splice(cache.entries.begin(), cache.entries, found->second);
+    stats.tableCacheHits++;
+    return found->second->second;
+}
+
+// Adds the tables just built to the table cache under `key`, dropping the
+// least recently used entries beyond its capacity. If another thread added
+// the same key meanwhile, its entry is kept.
+void HuffmanCoder::cacheTables(std::string key, bool legacy, uint64_t symbolCount, uint64_t payloadBits) {
+    auto cached = std::make_shared<CachedTables>();
+    cached->legacy = legacy;
+    cached->symbolCount = symbolCount;
+    cached->payloadBits = payloadBits;
+    cached->decodeTable = decodeTable;
+    if (legacy) {
+        cached->tree = tree;
+    } else {
+        cached->codeLengths = codeLengths;
+        cached->firstCode = firstCode;
+        cached->lengthCount = lengthCount;
+        cached->firstSymbolIndex = firstSymbolIndex;
+        cached->canonicalSymbols = canonicalSymbols;
+        cached->canonicalSymbolCount = canonicalSymbolCount;
+        cached->maxCodeLength = maxCodeLength;
+        cached->kernelTable = kernelTable;
+        cached->singleStreamKernel = singleStreamKernel;
+        cached->interleavedKernel = interleavedKernel;
+    }
+
+    DecodeTableCache::Impl& cache = *tableCache->impl;
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    if (cache.index.count(key)) return;
+    cache.entries.emplace_front(key, std::move(cached));
+    cache.index.emplace(std::move(key), cache.entries.begin());
+    while (cache.entries.size() > cache.capacity) {
+        cache.index.erase(cache.entries.back().first);
+        cache.entries.pop_back();
+    }
+}
+
+// Makes the cached tables the current ones. Only the part of the kernel
+// table the kernel reads and the tree nodes in use are copied.
+void HuffmanCoder::restoreTables(const CachedTables& cached) {
+    decodeTable = cached.decodeTable;
+    if (cached.legacy) {
+        tree.nodeCount = cached.tree.nodeCount;
+        tree.root = cached.tree.root;
+        std::copy_n(cached.tree.nodes.begin(), cached.tree.nodeCount, tree.nodes.begin());
+        return;
+    }
+    codeLengths = cached.codeLengths;
+    firstCode = cached.firstCode;
+    lengthCount = cached.lengthCount;
+    firstSymbolIndex = cached.firstSymbolIndex;
+    canonicalSymbols = cached.canonicalSymbols;
+    canonicalSymbolCount = cached.canonicalSymbolCount;
+    maxCodeLength = cached.maxCodeLength;
+    singleStreamKernel = cached.singleStreamKernel;
+    interleavedKernel = cached.interleavedKernel;
+    if (singleStreamKernel) {
+        size_t width = static_cast<size_t>(std::max(maxCodeLength, kMinKernelBits));
+        std::copy_n(cached.kernelTable.begin(), size_t(1) << width, kernelTable.begin());
+    }
+}
+
+// --- Canonical Decompression Implementation ---
+
+// Reads a code-length table written by writeCodeLengths.
+bool HuffmanCoder::readCodeLengths(ByteCursor& cursor) {
+    codeLengths.fill(0);
+    uint8_t countByte;
+    if (!cursor.get(countByte)) {
+        return false;
+    }
+    size_t symbolCount = size_t(countByte) + 1;
+    if (symbolCount < 128) {
+        if (cursor.remaining() < 2 * symbolCount) {
+            return false;
+        }
+        for (size_t i = 0; i < symbolCount; ++i) {
+            codeLengths[cursor.data[cursor.pos]] = cursor.data[cursor.pos + 1];
+            cursor.skip(2);
+        }
+    } else {
+        if (cursor.remaining() < codeLengths.size()) {
+            return false;
+        }
+        std::copy(cursor.data + cursor.pos, cursor.data + cursor.pos + codeLengths.size(), codeLengths.begin());
+        cursor.skip(codeLengths.size());
+    }
+    return true;
+}
+
+// Rebuilds the decode table from the code lengths at `table`, unless it was
+// already built from that same table.
+bool HuffmanCoder::loadTable(const unsigned char* table, size_t tableBytes) {
+    if (table == loadedTable) {
+        return true;
+    }
+    PhaseTimer timer(stats, kPhaseDecodeTables);
+    loadedTable = nullptr;
+    ByteCursor cursor{table, tableBytes};
+    std::string key;
+    if (tableCache) {
+        if (!skipCodeLengths(cursor)) return false;
+        key = tableCacheKey(kCanonicalTables, table, cursor.pos);
+        if (auto cached = findCachedTables(key)) {
+            restoreTables(*cached);
+            loadedTable = table;
+            return true;
+        }
+        cursor.pos = 0;
+    }
+    if (!readCodeLengths(cursor) || !buildCanonicalDecodeTable()) {
+        return false;
+    }
+    selectDecodeKernels();
+    if (tableCache) cacheTables(std::move(key), false, 0, 0);
+    loadedTable = table;
+    return true;
+}
+
+// Loads the tables a data block of `type` decodes with: the context tables
+// of a context block, otherwise the single code table.
+bool HuffmanCoder::loadBlockTables(uint8_t type, const unsigned char* table, size_t tableBytes) {
+    return type == kBlockContext ? loadContextTables(table, tableBytes) : loadTable(table, tableBytes);
+}
+
+// Derives the canonical code layout from codeLengths and fills the decode
+// table. Fails if the lengths cannot form a prefix code.
+bool HuffmanCoder::buildCanonicalDecodeTable() {
+    lengthCount.fill(0);
+    maxCodeLength = 0;
+    size_t symbolCount = 0;
+    for (uint8_t length : codeLengths) {
+        if (length > kMaxCodeLength) {
+            return false;
+        }
+        if (length) {
+            lengthCount[length]++;
+            maxCodeLength = std::max<int>(maxCodeLength, length);
+            symbolCount++;
+        }
+    }
+    if (symbolCount == 0) {
+        return false;
+    }
+    canonicalSymbolCount = symbolCount;
+
+    // Order symbols by (length, value) and compute the first code of each length.
+    uint32_t index = 0;
+    uint64_t code = 0;
+    for (int length = 1; length <= maxCodeLength; ++length) {
+        code = (code + lengthCount[length - 1]) << 1;
+        firstCode[length] = code;
+        firstSymbolIndex[length] = index;
+        index += lengthCount[length];
+        if (code + lengthCount[length] > (uint64_t(1) << length)) {
+            return false;
+        }
+    }
+    std::array<uint32_t, kMaxCodeLength + 1> nextIndex = firstSymbolIndex;
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        if (codeLengths[symbol]) {
+            canonicalSymbols[nextIndex[codeLengths[symbol]]++] = static_cast<unsigned char>(symbol);
+        }
+    }
+
+    decodeTable.fill(DecodeEntry());
+    for (int length = 1; length <= maxCodeLength; ++length) {
+        for (uint32_t i = 0; i < lengthCount[length]; ++i) {
+            DecodeEntry entry;
+            entry.symbol = static_cast<char>(canonicalSymbols[firstSymbolIndex[length] + i]);
+            uint64_t symbolCode = firstCode[length] + i;
+            if (length <= kLookupBits) {
+                entry.length = static_cast<uint8_t>(length);
+                uint32_t first = static_cast<uint32_t>(symbolCode << (kLookupBits - length));
+                uint32_t count = 1u << (kLookupBits - length);
+                for (uint32_t slot = 0; slot < count; ++slot) {
+                    decodeTable[first + slot] = entry;
+                }
+            } else {
+                entry.length = kLookupBits;
+                entry.longCanonical = true;
+                decodeTable[symbolCode >> (length - kLookupBits)] = entry;
+            }
+        }
+    }
+    return true;
+}
+
+// --- Context Decoding Implementation ---
+
+// Builds the per-group decode tables of a context block from its context map
+// and code lengths. Every code fits the lookup window, so each table slot
+// resolves a symbol outright.
+bool HuffmanCoder::loadContextTables(const unsigned char* table, size_t tableBytes) {
+    PhaseTimer timer(stats, kPhaseDecodeTables);
+    loadedTable = nullptr;
+    ByteCursor cursor{table, tableBytes};
+    uint8_t countByte;
+    if (!cursor.get(countByte) || size_t(countByte) >= kMaxContextGroups) return false;
+    size_t groups = size_t(countByte) + 1;
+    contextGroup.fill(0);
+    if (groups > 1) {
+        for (int context = 0; context < 256; context += 2) {
+            uint8_t pair;
+            if (!cursor.get(pair)) return false;
+            contextGroup[context] = pair & 0x0F;
+            contextGroup[context + 1] = pair >> 4;
+            if (contextGroup[context] >= groups || contextGroup[context + 1] >= groups) return false;
+        }
+    }
+    constexpr size_t kTableSize = size_t(1) << kLookupBits;
+    contextTables.resize(groups * kTableSize);
+    for (size_t group = 0; group < groups; ++group) {
+        if (!readCodeLengths(cursor) || !buildCanonicalDecodeTable() || maxCodeLength > kLookupBits) {
+            return false;
+        }
+        fillLookupTable(contextTables.data() + group * kTableSize, kLookupBits);
+    }
+    for (int context = 0; context < 256; ++context) {
+        contextTableOffset[context] = static_cast<uint32_t>(contextGroup[context] * kTableSize);
+    }
+    return true;
+}
+
+// Decodes all `count` symbols of a context block. Each symbol's table is
+// picked by the symbol before it, so symbols decode strictly one after
+// another; the fast path checks bounds and validity once per four of them.
+bool HuffmanCoder::decodeContext(const unsigned char* payload, size_t payloadSize, char* output, size_t count) {
+    PhaseTimer timer(stats, kPhaseDecode);
+    BitReader reader(payload, payloadSize);
+    const LookupEntry* tables = contextTables.data();
+    unsigned previous = 0;
+    size_t i = 0;
+    constexpr int kSymbolsPerRefill = 4;
+    while (count - i >= kSymbolsPerRefill) {
+        reader.refill();
+        if (reader.available() < kSymbolsPerRefill * kLookupBits) break;
+        bool valid = true;
+        for (int step = 0; step < kSymbolsPerRefill; ++step) {
+            const LookupEntry& entry = tables[contextTableOffset[previous] + reader.peek(kLookupBits)];
+            output[i + step] = static_cast<char>(entry.symbol);
+            valid &= entry.length != 0;
+            reader.consume(entry.length);
+            previous = entry.symbol;
+        }
+        if (!valid) return false;
+        i += kSymbolsPerRefill;
+    }
+    for (; i < count; ++i) {
+        reader.refill();
+        const LookupEntry& entry = tables[contextTableOffset[previous] + reader.peek(kLookupBits)];
+        if (entry.length == 0 || entry.length > reader.available()) return false;
+        output[i] = static_cast<char>(entry.symbol);
+        reader.consume(entry.length);
+        previous = entry.symbol;
+    }
+    stats.symbolsDecoded += count;
+    stats.bitsDecoded += reader.position();
+    countBytes(kPhaseDecode, payloadSize, count);
+    return true;
+}
+
+// --- Small Alphabet Decoding Implementation ---
+
+// Expands the `Width`-bit indices of a small alphabet block into `count`
+// bytes. A 256-entry table maps every packed byte to the 8 / Width bytes it
+// stands for, so each payload byte costs one load and one store. Fails if an
+// index names no symbol.
+template <int Width>
+bool HuffmanCoder::expandIndices(const unsigned char* packed, size_t packedBytes, const unsigned char* symbols,
+                                 size_t symbolCount, char* output, size_t count) {
+    constexpr size_t kPerByte = 8 / Width;
+    constexpr unsigned kMask = (1u << Width) - 1;
+    struct Expansion {
+        unsigned char bytes[kPerByte];
+    };
+    std::array<Expansion, 256> expansions;
+    std::array<bool, 256> invalid{};
+    for (unsigned byte = 0; byte < 256; ++byte) {
+        for (size_t j = 0; j < kPerByte; ++j) {
+            unsigned index = (byte >> (8 - Width * (j + 1))) & kMask;
+            invalid[byte] |= index >= symbolCount;
+            expansions[byte].bytes[j] = index < symbolCount ? symbols[index] : 0;
+        }
+    }
+    if (packedBytes != (count + kPerByte - 1) / kPerByte) return false;
+    size_t whole = count / kPerByte;
+    bool bad = false;
+    for (size_t i = 0; i < whole; ++i) {
+        std::memcpy(output + i * kPerByte, expansions[packed[i]].bytes, kPerByte);
+        bad |= invalid[packed[i]];
+    }
+    if (bad) return false;
+    for (size_t j = 0; whole * kPerByte + j < count; ++j) {
+        unsigned index = (packed[whole] >> (8 - Width * (j + 1))) & kMask;
+        if (index >= symbolCount) return false;
+        output[whole * kPerByte + j] = static_cast<char>(symbols[index]);
+    }
+    return true;
+}
+
+// Decodes a small alphabet block into `count` bytes.
+bool HuffmanCoder::decodeSmallAlphabet(const unsigned char* payload, size_t payloadSize, char* output,
+                                       size_t count) {
+    PhaseTimer timer(stats, kPhaseDecode);
+    if (payloadSize < 1) return false;
+    size_t symbolCount = payload[0];
+    if (symbolCount < 2 || symbolCount > kMaxSmallAlphabet || payloadSize < 1 + symbolCount) return false;
+    const unsigned char* symbols = payload + 1;
+    const unsigned char* packed = symbols + symbolCount;
+    size_t packedBytes = payloadSize - 1 - symbolCount;
+    bool decoded = symbolCount == 2 ? expandIndices<1>(packed, packedBytes, symbols, symbolCount, output, count)
+                                    : expandIndices<2>(packed, packedBytes, symbols, symbolCount, output, count);
+    if (!decoded) return false;
+    stats.symbolsDecoded += count;
+    stats.bitsDecoded += uint64_t(count) * (symbolCount == 2 ? 1 : 2);
+    countBytes(kPhaseDecode, payloadSize, count);
+    return true;
+}
+
+// Returns the table with `id` among the caller's tables, serialized like a
+// table block for loadTable(). Notes the ID if no such table was supplied.
+const std::vector<unsigned char>* HuffmanCoder::findDictionary(uint32_t id, const DecompressionOptions& options) {
+    for (const auto& entry : dictionaries) {
+        if (entry.first == id) return &entry.second;
+    }
+    for (const CodeTable* table : options.tables) {
+        if (table && table->id == id) {
+            std::vector<unsigned char> bytes(1 + table->codeLengths.size());
+            bytes[0] = 255;
+            std::copy(table->codeLengths.begin(), table->codeLengths.end(), bytes.begin() + 1);
+            dictionaries.emplace_back(id, std::move(bytes));
+            return &dictionaries.back().second;
+        }
+    }
+    dictionaryMissing = true;
+    missingDictionary = id;
+    return nullptr;
+}
+
+// Reads the trailing block index of a mapped container into `entries`: the
+// file offset and original size of every block, in order (table and
+// dictionary blocks have an original size of zero). Returns false if the file
+// has no index or it is damaged.
+bool HuffmanCoder::readBlockIndex(const unsigned char* data, size_t size, std::vector<IndexEntry>& entries) {
+    entries.clear();
+    if (size < kFileHeaderSize + kFooterSize ||
+        !std::equal(kIndexMagic, kIndexMagic + sizeof(kIndexMagic),
+                    reinterpret_cast<const char*>(data + size - sizeof(kIndexMagic)))) {
+        return false;
+    }
+    uint64_t indexOffset = 0;
+    for (int i = 0; i < 8; ++i) {
+        indexOffset |= uint64_t(data[size - kFooterSize + i]) << (8 * i);
+    }
+    ByteCursor cursor{data, size - kFooterSize, 0};
+    uint64_t count = 0;
+    uint64_t offset = kFileHeaderSize;
+    if (indexOffset >= cursor.size || !cursor.skip(indexOffset) || !cursor.readVarint(count) ||
+        count > cursor.remaining()) {
+        return false;
+    }
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t originalSize, blockBytes;
+        if (!cursor.readVarint(originalSize) || !cursor.readVarint(blockBytes) || offset > indexOffset) {
+            entries.clear();
+            return false;
+        }
+        entries.push_back({offset, originalSize});
+        offset += blockBytes;
+    }
+    return !entries.empty();
+}
+
+// Parses the block at the cursor and moves past it. Table, dictionary and
+// Huffman blocks replace `sharedTable`, which shared blocks then refer to.
+bool HuffmanCoder::parseBlock(ByteCursor& cursor, const DecompressionOptions& options,
+                              const unsigned char*& sharedTable, size_t& sharedTableBytes, BlockInfo& block) {
+    uint8_t type;
+    if (!cursor.get(type)) return false;
+    block.type = type & ~kBlockChecksumFlag;
+    if (type & kBlockChecksumFlag && !isDataBlock(block.type)) return false;
+    if (block.type == kBlockEnd) return true;
+
+    if (block.type == kBlockStreamChecksum) {
+        if (cursor.remaining() < 4) return false;
+        block.checksummed = true;
+        block.checksum = readUint32(cursor.data + cursor.pos);
+        return cursor.skip(4);
+    }
+
+    if (block.type == kBlockTable) {
+        sharedTable = cursor.data + cursor.pos;
+        sharedTableBytes = cursor.remaining();
+        return skipCodeLengths(cursor);
+    }
+    if (block.type == kBlockDictionary) {
+        if (cursor.remaining() < 4) return false;
+        const std::vector<unsigned char>* dictionary = findDictionary(readUint32(cursor.data + cursor.pos), options);
+        cursor.skip(4);
+        if (!dictionary) return false;
+        sharedTable = dictionary->data();
+        sharedTableBytes = dictionary->size();
+        return true;
+    }
+    if (!isDataBlock(block.type)) return false;
+
+    uint64_t payloadSize;
+    if (!cursor.readVarint(block.originalSize) || !cursor.readVarint(payloadSize) ||
+        !plausibleBlockSizes(block.type, block.originalSize, payloadSize)) {
+        return false;
+    }
+    if (type & kBlockChecksumFlag) {
+        if (cursor.remaining() < 4) return false;
+        block.checksummed = true;
+        block.checksum = readUint32(cursor.data + cursor.pos);
+        cursor.skip(4);
+    }
+    if (hasOwnTable(block.type) || block.type == kBlockContext) {
+        block.table = cursor.data + cursor.pos;
+        block.tableBytes = cursor.remaining();
+        if (!(block.type == kBlockContext ? skipContextTables(cursor) : skipCodeLengths(cursor))) return false;
+        if (block.type != kBlockContext) {
+            sharedTable = block.table;
+            sharedTableBytes = block.tableBytes;
+        }
+    } else if (isCoded(block.type)) {
+        if (!sharedTable) return false;
+        block.table = sharedTable;
+        block.tableBytes = sharedTableBytes;
+    }
+    if (payloadSize > cursor.remaining()) return false;
+    block.payload = cursor.data + cursor.pos;
+    block.payloadSize = static_cast<size_t>(payloadSize);
+    cursor.skip(block.payloadSize);
+    return true;
+}
+
+// Finds every block of a mapped container. The trailing index is used when
+// present; files without one (or with a damaged one) are scanned block by
+// block, since each header records its own payload size.
+bool HuffmanCoder::locateBlocks(const InputSource& input, const DecompressionOptions& options,
+                                std::vector<BlockInfo>& blocks) {
+    PhaseTimer timer(stats, kPhaseHeader);
+    std::vector<IndexEntry> index;
+    bool indexed = readBlockIndex(input.data(), input.size(), index);
+
+    ByteCursor cursor{input.data(), input.size(), kFileHeaderSize};
+    const unsigned char* sharedTable = nullptr;
+    size_t sharedTableBytes = 0;
+    blocks.clear();
+    for (size_t i = 0; !indexed || i < index.size(); ++i) {
+        if (indexed) {
+            if (index[i].offset > cursor.size) return false;
+            cursor.pos = static_cast<size_t>(index[i].offset);
+        }
+        BlockInfo block;
+        if (!parseBlock(cursor, options, sharedTable, sharedTableBytes, block)) return false;
+        if (block.type == kBlockEnd) return !indexed;
+        blocks.push_back(block);
+    }
+    return true;
+}
+
+// Finds the data blocks holding the original bytes [offset, offset + length),
+// and in `skip` how many leading bytes of the first one fall before the range.
+// With an index, only those blocks and the block whose table they use are parsed;
+// otherwise every block header is read, but no payload.
+bool HuffmanCoder::locateRange(const InputSource& input, const DecompressionOptions& options, uint64_t offset,
+                               uint64_t length, std::vector<BlockInfo>& blocks, uint64_t& skip) {
+    uint64_t end = length > UINT64_MAX - offset ? UINT64_MAX : offset + length;
+    blocks.clear();
+    skip = 0;
+
+    std::vector<IndexEntry> index;
+    if (!readBlockIndex(input.data(), input.size(), index)) {
+        std::vector<BlockInfo> all;
+        if (!locateBlocks(input, options, all)) return false;
+        uint64_t position = 0;
+        for (const BlockInfo& block : all) {
+            if (!isDataBlock(block.type)) continue;
+            if (position >= end) break;
+            if (position + block.originalSize > offset) {
+                if (blocks.empty()) skip = offset - position;
+                blocks.push_back(block);
+            }
+            position += block.originalSize;
+        }
+        return true;
+    }
+
+    // Select the blocks by the sizes in the index.
+    PhaseTimer timer(stats, kPhaseHeader);
+    size_t firstData = 0, last = 0;
+    bool found = false;
+    uint64_t position = 0;
+    for (size_t i = 0; i < index.size() && position < end; ++i) {
+        if (index[i].originalSize == 0) continue;
+        if (position + index[i].originalSize > offset) {
+            if (!found) {
+                firstData = i;
+                skip = offset - position;
+                found = true;
+            }
+            last = i + 1;
+        }
+        position += index[i].originalSize;
+    }
+    if (!found) return true;
+
+    // Parsing starts at the last block up to the range that sets the table
+    // its shared blocks refer to. The blocks between that one and the range
+    // leave the table alone, so they are skipped.
+    auto setsTable = [&](size_t i) {
+        if (index[i].offset >= input.size()) return false;
+        uint8_t type = input.data()[index[i].offset] & ~kBlockChecksumFlag;
+        return type == kBlockTable || type == kBlockDictionary || hasOwnTable(type);
+    };
+    size_t first = firstData;
+    while (first > 0 && !setsTable(first)) {
+        first--;
+    }
+
+    ByteCursor cursor{input.data(), input.size(), 0};
+    const unsigned char* sharedTable = nullptr;
+    size_t sharedTableBytes = 0;
+    for (size_t i = first; i < last; i = std::max(i + 1, firstData)) {
+        if (index[i].offset > cursor.size) return false;
+        cursor.pos = static_cast<size_t>(index[i].offset);
+        BlockInfo block;
+        if (!parseBlock(cursor, options, sharedTable, sharedTableBytes, block) ||
+            block.originalSize != index[i].originalSize) {
+            return false;
+        }
+        if (i >= firstData && isDataBlock(block.type)) blocks.push_back(block);
+    }
+    return true;
+}
+
+// Decodes every block of a canonical container.
+bool HuffmanCoder::decompressContainer(const InputSource& input, std::ostream& outputFile,
+                                        const DecompressionOptions& options) {
+    if (input.size() < kFileHeaderSize || input.data()[sizeof(kFormatMagic)] != kFormatVersion) {
+        return false;
+    }
+
+    *progress << "Reading block index..." << std::endl;
+    std::vector<BlockInfo> blocks;
+    if (!locateBlocks(input, options, blocks)) {
+        return false;
+    }
+    return decodeBlocks(blocks, outputFile, options);
+}
+
+// Decodes located blocks and writes them out in order. Blocks are
+// independent, so they are decoded a window at a time on a pool of workers.
+// Checksummed blocks are verified as they are decoded, while still in cache.
+bool HuffmanCoder::decodeBlocks(const std::vector<BlockInfo>& blocks, std::ostream& outputFile,
+                                const DecompressionOptions& options) {
+    unsigned threads = static_cast<unsigned>(std::min<size_t>(resolveThreads(options.threads), blocks.size()));
+    size_t dataBlocks = std::count_if(blocks.begin(), blocks.end(),
+                                      [](const BlockInfo& block) { return isDataBlock(block.type); });
+    *progress << "Decoding " << dataBlocks << " block(s) on " << std::max(threads, 1u)
+              << " thread(s)..." << std::endl;
+    uint32_t streamChecksum = 0;
+    if (threads <= 1) {
+        std::vector<char> decoded;
+        for (const BlockInfo& block : blocks) {
+            if (block.type == kBlockStreamChecksum) {
+                if (!verifyStream(block.checksum, streamChecksum)) return false;
+                continue;
+            }
+            if (!isDataBlock(block.type)) continue;
+            // A block is verified before any of it is written, so output stops
+            // at the last good block when a checksum fails.
+            uint32_t checksum = 0;
+            if (block.type == kBlockStored) {
+                // Written straight from the mapped input.
+                if (block.payloadSize != block.originalSize) return false;
+                if (block.checksummed) checksum = computeChecksum(0, block.payload, block.payloadSize);
+                if (!verifyBlock(block.checksummed, block.checksum, checksum, block.originalSize, streamChecksum)) {
+                    return false;
+                }
+                outputFile.write(reinterpret_cast<const char*>(block.payload), block.payloadSize);
+            } else if (block.type == kBlockRun) {
+                if (!writeRunBlock(block.payload, block.payloadSize, block.originalSize, block.checksummed,
+                                   block.checksum, streamChecksum, outputFile)) {
+                    return false;
+                }
+            } else if (isCoded(block.type) && !loadBlockTables(block.type, block.table, block.tableBytes)) {
+                return false;
+            } else if (isCoded(block.type) && !isInterleaved(block.type) && block.type != kBlockContext &&
+                       !block.checksummed) {
+                if (!decodeToStream(block.payload, block.payloadSize, block.originalSize, outputFile)) {
+                    return false;
+                }
+            } else {
+                // Interleaved streams fill the output out of order, context and
+                // small alphabet blocks have no chunked decoder, and checksummed
+                // blocks are verified first, so the block is decoded whole
+                // before it is written.
+                decoded.resize(static_cast<size_t>(block.originalSize));
+                if (!decodeBlock(block.type, block.payload, block.payloadSize, decoded.data(), decoded.size())) {
+                    return false;
+                }
+                if (block.checksummed) {
+                    checksum = computeChecksum(0, reinterpret_cast<const unsigned char*>(decoded.data()),
+                                               decoded.size());
+                }
+                if (!verifyBlock(block.checksummed, block.checksum, checksum, block.originalSize, streamChecksum)) {
+                    return false;
+                }
+                outputFile.write(decoded.data(), decoded.size());
+            }
+        }
+        return true;
+    }
+
+    prepareWorkers(threads);
+    for (auto& worker : workers) {
+        worker.tableCache = tableCache;
+    }
+    // A window holds up to two blocks per thread, and no more decoded bytes
+    // than kDecodeWindowBytes beyond its first block.
+    size_t window = size_t(threads) * 2;
+    std::vector<std::vector<char>> decoded(window);
+    std::vector<char> succeeded(window);
+    std::vector<uint32_t> checksums(window);
+    for (size_t first = 0, count; first < blocks.size(); first += count) {
+        uint64_t windowBytes = 0;
+        for (count = 0; count < window && first + count < blocks.size(); ++count) {
+            const BlockInfo& block = blocks[first + count];
+            uint64_t blockBytes = block.type == kBlockRun ? 0 : block.originalSize;
+            if (count > 0 && windowBytes + blockBytes > kDecodeWindowBytes) break;
+            windowBytes += blockBytes;
+        }
+        parallelFor(count, threads, [&](size_t i, unsigned worker) {
+            const BlockInfo& block = blocks[first + i];
+            HuffmanCoder& coder = workers[worker];
+            if (block.type == kBlockRun) {
+                succeeded[i] = true;
+                return;
+            }
+            decoded[i].resize(static_cast<size_t>(block.originalSize));
+            succeeded[i] = !isDataBlock(block.type) ||
+                           ((!isCoded(block.type) || coder.loadBlockTables(block.type, block.table, block.tableBytes)) &&
+                            coder.decodeBlock(block.type, block.payload, block.payloadSize, decoded[i].data(),
+                                              decoded[i].size()));
+            if (succeeded[i] && isDataBlock(block.type) && block.checksummed) {
+                checksums[i] = coder.computeChecksum(0, reinterpret_cast<const unsigned char*>(decoded[i].data()),
+                                                     decoded[i].size());
+            }
+        });
+        for (size_t i = 0; i < count; ++i) {
+            const BlockInfo& block = blocks[first + i];
+            if (!succeeded[i]) {
+                return false;
+            }
+            if (block.type == kBlockStreamChecksum) {
+                if (!verifyStream(block.checksum, streamChecksum)) return false;
+                continue;
+            }
+            if (block.type == kBlockRun) {
+                if (!writeRunBlock(block.payload, block.payloadSize, block.originalSize, block.checksummed,
+                                   block.checksum, streamChecksum, outputFile)) {
+                    return false;
+                }
+                continue;
+            }
+            if (isDataBlock(block.type) &&
+                !verifyBlock(block.checksummed, block.checksum, checksums[i], block.originalSize, streamChecksum)) {
+                return false;
+            }
+            outputFile.write(decoded[i].data(), decoded[i].size());
+        }
+    }
+    for (const auto& worker : workers) {
+        addWorkerStats(worker);
+    }
+    return true;
+}
+
+// --- Checksum Implementation ---
+
+uint32_t HuffmanCoder::computeChecksum(uint32_t crc, const unsigned char* data, size_t size) {
+    PhaseTimer timer(stats, kPhaseChecksum);
+    countBytes(kPhaseChecksum, size, 0);
+    return crc32c(crc, data, size);
+}
+
+// Compares a decoded block's checksum with the stored one and extends the
+// checksum of the whole stream by it. Blocks without a checksum pass.
+bool HuffmanCoder::verifyBlock(bool checksummed, uint32_t stored, uint32_t actual, uint64_t size,
+                               uint32_t& streamChecksum) {
+    if (!checksummed) return true;
+    if (actual != stored) {
+        checksumMismatch = true;
+        return false;
+    }
+    streamChecksum = crc32cCombine(streamChecksum, actual, size);
+    return true;
+}
+
+// Checks the stream checksum block against the blocks decoded before it;
+// this also catches blocks that were dropped or reordered as a whole.
+bool HuffmanCoder::verifyStream(uint32_t stored, uint32_t actual) {
+    if (actual != stored) {
+        checksumMismatch = true;
+        return false;
+    }
+    return true;
+}
+
+
+// Decodes a compressed stream block by block, holding only one block in
+// memory at a time. Original-format input has no block structure, so it is
+// read in full and decoded as usual.
+bool HuffmanCoder::decompressStream(std::istream& input, std::ostream& outputFile,
+                                    const DecompressionOptions& options) {
+    char magic[sizeof(kFormatMagic)];
+    input.read(magic, sizeof(magic));
+    size_t got = static_cast<size_t>(input.gcount());
+    if (got == 0) {
+        *progress << "Input is empty. Creating an empty decompressed file." << std::endl;
+        return true;
+    }
+    if (got < sizeof(magic) || !std::equal(magic, magic + sizeof(magic), kFormatMagic)) {
+        std::vector<unsigned char> bytes(magic, magic + got);
+        bytes.insert(bytes.end(), std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+        InputSource whole;
+        whole.assign(std::move(bytes));
+        return decompressLegacy(whole, outputFile, options);
+    }
+
+    char version;
+    if (!input.get(version) || static_cast<uint8_t>(version) != kFormatVersion) {
+        return false;
+    }
+
+    *progress << "Decoding blocks..." << std::endl;
+    std::vector<unsigned char> table, sharedTable, payload;
+    std::vector<char> decoded;
+    uint32_t streamChecksum = 0;
+    char byte;
+    while (input.get(byte)) {
+        uint8_t type = static_cast<uint8_t>(byte) & ~kBlockChecksumFlag;
+        bool checksummed = static_cast<uint8_t>(byte) & kBlockChecksumFlag;
+        if (checksummed && !isDataBlock(type)) {
+            return false;
+        }
+        if (type == kBlockEnd) {
+            return true;
+        }
+        if (type == kBlockStreamChecksum) {
+            unsigned char stored[4];
+            input.read(reinterpret_cast<char*>(stored), sizeof(stored));
+            if (input.gcount() != sizeof(stored) || !verifyStream(readUint32(stored), streamChecksum)) return false;
+            continue;
+        }
+        if (type == kBlockTable) {
+            if (!readTableBytes(input, sharedTable)) return false;
+            loadedTable = nullptr;
+            continue;
+        }
+        if (type == kBlockDictionary) {
+            unsigned char id[4];
+            input.read(reinterpret_cast<char*>(id), sizeof(id));
+            if (input.gcount() != sizeof(id)) return false;
+            const std::vector<unsigned char>* dictionary = findDictionary(readUint32(id), options);
+            if (!dictionary) return false;
+            sharedTable = *dictionary;
+            loadedTable = nullptr;
+            continue;
+        }
+        if (!isDataBlock(type)) {
+            return false;
+        }
+
+        uint64_t originalSize, payloadSize;
+        if (!readVarint(input, originalSize) || !readVarint(input, payloadSize) ||
+            !plausibleBlockSizes(type, originalSize, payloadSize)) {
+            return false;
+        }
+        uint32_t stored = 0;
+        if (checksummed) {
+            unsigned char bytes[4];
+            input.read(reinterpret_cast<char*>(bytes), sizeof(bytes));
+            if (input.gcount() != sizeof(bytes)) return false;
+            stored = readUint32(bytes);
+        }
+        auto verify = [&](const unsigned char* data, size_t size) {
+            uint32_t actual = checksummed ? computeChecksum(0, data, size) : 0;
+            return verifyBlock(checksummed, stored, actual, size, streamChecksum);
+        };
+        if (type == kBlockStored) {
+            if (payloadSize != originalSize || !readBlockBytes(input, payloadSize, payload) ||
+                !verify(payload.data(), payload.size())) {
+                return false;
+            }
+            outputFile.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+            outputFile.flush();
+            continue;
+        }
+        if (type == kBlockRun) {
+            if (!readBlockBytes(input, payloadSize, payload) ||
+                !writeRunBlock(payload.data(), payload.size(), originalSize, checksummed, stored, streamChecksum,
+                               outputFile)) {
+                return false;
+            }
+            outputFile.flush();
+            continue;
+        }
+        const std::vector<unsigned char>* blockTable = &sharedTable;
+        if (!isCoded(type)) {
+            blockTable = nullptr;
+        } else if (type == kBlockContext) {
+            if (!readContextTableBytes(input, table)) return false;
+            blockTable = &table;
+        } else if (hasOwnTable(type)) {
+            if (!readTableBytes(input, sharedTable)) return false;
+            loadedTable = nullptr;
+        } else if (sharedTable.empty()) {
+            return false;
+        }
+
+        // The output buffer is sized only once the whole payload has arrived.
+        if (!readBlockBytes(input, payloadSize, payload) ||
+            (blockTable && !loadBlockTables(type, blockTable->data(), blockTable->size()))) {
+            return false;
+        }
+        decoded.resize(static_cast<size_t>(originalSize));
+        if (!decodeBlock(type, payload.data(), payload.size(), decoded.data(), decoded.size()) ||
+            !verify(reinterpret_cast<const unsigned char*>(decoded.data()), decoded.size())) {
+            return false;
+        }
+        outputFile.write(decoded.data(), decoded.size());
+        outputFile.flush();
+    }
+    return false;
+}
+
+
+bool HuffmanCoder::decompress(const std::string& inputFilePath, const std::string& outputFilePath,
+                               const DecompressionOptions& options) {
+    // "-" selects stdout; progress messages then go to stderr.
+    OutputSink sink;
+    if (!sink.open(outputFilePath, options.output)) {
+        std::cerr << "Error: Could not open output file: " << outputFilePath << std::endl;
+        return false;
+    }
+    std::ostream output(&sink);
+    progress = quiet ? &nullStream : outputFilePath == "-" ? &std::cerr : &std::cout;
+
+    loadedTable = nullptr;
+    tableCache = options.tableCache;
+
+    // "-" selects stdin, which is decoded as a stream with bounded memory.
+    if (inputFilePath == "-") {
+        dictionaries.clear();
+        dictionaryMissing = false;
+        checksumMismatch = false;
+        if (!decompressStream(std::cin, output, options)) {
+            if (dictionaryMissing) {
+                std::cerr << "Error: The stream needs code table " << tableIdString(missingDictionary)
+                          << "; pass it with --table." << std::endl;
+            } else if (checksumMismatch) {
+                std::cerr << "Error: Compressed stream failed its checksum; the data is corrupt." << std::endl;
+            } else {
+                std::cerr << "Error: Compressed stream is corrupt or truncated." << std::endl;
+            }
+            return false;
+        }
+        if (!sink.close()) {
+            std::cerr << "Error: Could not write output file: " << outputFilePath << std::endl;
+            return false;
+        }
+        *progress << "Decompression successful!" << std::endl;
+        return true;
+    }
+
+    InputSource input;
+    if (!input.open(inputFilePath)) {
+        std::cerr << "Error: Could not open input file: " << inputFilePath << std::endl;
+        return false;
+    }
+
+    // An empty file decompresses to an empty file.
+    if (input.size() == 0) {
+        *progress << "Input file is empty. Creating an empty decompressed file." << std::endl;
+        return true;
+    }
+    if (!decompressInput(input, output, options)) {
+        if (dictionaryMissing) {
+            std::cerr << "Error: " << inputFilePath << " needs code table " << tableIdString(missingDictionary)
+                      << "; pass it with --table." << std::endl;
+        } else if (checksumMismatch) {
+            std::cerr << "Error: Compressed file failed its checksum; the data is corrupt: " << inputFilePath
+                      << std::endl;
+        } else {
+            std::cerr << "Error: Compressed file is corrupt or truncated: " << inputFilePath << std::endl;
+        }
+        return false;
+    }
+    if (!sink.close()) {
+        std::cerr << "Error: Could not write output file: " << outputFilePath << std::endl;
+        return false;
+    }
+    input.close();
+
+    *progress << "Decompression successful!" << std::endl;
+    return true;
+}
+
+bool HuffmanCoder::decompress(const unsigned char* data, size_t size, std::vector<unsigned char>& output,
+                              const DecompressionOptions& options) {
+    progress = &nullStream;
+    loadedTable = nullptr;
+    tableCache = options.tableCache;
+    output.clear();
+    if (size == 0) {
+        return true;
+    }
+    InputSource input;
+    input.wrap(data, size);
+    VectorStreamBuffer buffer(output);
+    std::ostream stream(&buffer);
+    return decompressInput(input, stream, options);
+}
+
+bool HuffmanCoder::decompress(std::istream& input, std::ostream& output, const DecompressionOptions& options) {
+    progress = &nullStream;
+    loadedTable = nullptr;
+    tableCache = options.tableCache;
+    dictionaries.clear();
+    dictionaryMissing = false;
+    checksumMismatch = false;
+    return decompressStream(input, output, options) && output.flush();
+}
+
+// Decodes a non-empty input. Canonical-mode input is recognised by its magic;
+// anything else is read as the original format.
+bool HuffmanCoder::decompressInput(const InputSource& input, std::ostream& output,
+                                   const DecompressionOptions& options) {
+    dictionaries.clear();
+    dictionaryMissing = false;
+    checksumMismatch = false;
+    if (input.size() >= sizeof(kFormatMagic) &&
+        std::equal(kFormatMagic, kFormatMagic + sizeof(kFormatMagic), reinterpret_cast<const char*>(input.data()))) {
+        return decompressContainer(input, output, options);
+    }
+    return decompressLegacy(input, output, options);
+}
+
+// --- Range Extraction Implementation ---
+
+bool HuffmanCoder::extract(const std::string& inputFilePath, const std::string& outputFilePath, uint64_t offset,
+                           uint64_t length, const DecompressionOptions& options) {
+    OutputSink sink;
+    if (!sink.open(outputFilePath, options.output)) {
+        std::cerr << "Error: Could not open output file: " << outputFilePath << std::endl;
+        return false;
+    }
+    std::ostream output(&sink);
+    progress = quiet ? &nullStream : outputFilePath == "-" ? &std::cerr : &std::cout;
+    loadedTable = nullptr;
+    tableCache = options.tableCache;
+    dictionaries.clear();
+    dictionaryMissing = false;
+    checksumMismatch = false;
+
+    // A stream cannot seek, so it is decoded from the start and everything
+    // outside the range is dropped.
+    bool extracted;
+    InputSource input;
+    if (inputFilePath == "-") {
+        SliceStreamBuffer slice(output, offset, length);
+        std::ostream sliced(&slice);
+        extracted = decompressStream(std::cin, sliced, options) && sliced.flush();
+    } else if (!input.open(inputFilePath)) {
+        std::cerr << "Error: Could not open input file: " << inputFilePath << std::endl;
+        return false;
+    } else {
+        extracted = input.size() == 0 || extractInput(input, output, offset, length, options);
+    }
+    if (!extracted) {
+        if (dictionaryMissing) {
+            std::cerr << "Error: " << inputFilePath << " needs code table " << tableIdString(missingDictionary)
+                      << "; pass it with --table." << std::endl;
+        } else if (checksumMismatch) {
+            std::cerr << "Error: Compressed file failed its checksum; the data is corrupt: " << inputFilePath
+                      << std::endl;
+        } else {
+            std::cerr << "Error: Compressed file is corrupt or truncated: " << inputFilePath << std::endl;
+        }
+        return false;
+    }
+    if (!sink.close()) {
+        std::cerr << "Error: Could not write output file: " << outputFilePath << std::endl;
+        return false;
+    }
+    *progress << "Extraction successful!" << std::endl;
+    return true;
+}
+
+bool HuffmanCoder::extract(const unsigned char* data, size_t size, uint64_t offset, uint64_t length,
+                           std::vector<unsigned char>& output, const DecompressionOptions& options) {
+    progress = &nullStream;
+    loadedTable = nullptr;
+    tableCache = options.tableCache;
+    output.clear();
+    if (size == 0) {
+        return true;
+    }
+    InputSource input;
+    input.wrap(data, size);
+    VectorStreamBuffer buffer(output);
+    std::ostream stream(&buffer);
+    return extractInput(input, stream, offset, length, options);
+}
+
+// Writes the original bytes [offset, offset + length) of a non-empty input,
+// cut short at the end of the data. In a canonical container only the blocks
+// overlapping the range are decoded; the original format has no blocks, so it
+// is decoded in full.
+bool HuffmanCoder::extractInput(const InputSource& input, std::ostream& output, uint64_t offset, uint64_t length,
+                                const DecompressionOptions& options) {
+    dictionaries.clear();
+    dictionaryMissing = false;
+    checksumMismatch = false;
+    bool container =
+        input.size() >= sizeof(kFormatMagic) &&
+        std::equal(kFormatMagic, kFormatMagic + sizeof(kFormatMagic), reinterpret_cast<const char*>(input.data()));
+    if (!container) {
+        SliceStreamBuffer slice(output, offset, length);
+        std::ostream sliced(&slice);
+        return decompressLegacy(input, sliced, options) && sliced.flush();
+    }
+    if (input.size() < kFileHeaderSize || input.data()[sizeof(kFormatMagic)] != kFormatVersion) {
+        return false;
+    }
+
+    *progress << "Locating blocks..." << std::endl;
+    std::vector<BlockInfo> blocks;
+    uint64_t skip;
+    if (!locateRange(input, options, offset, length, blocks, skip)) {
+        return false;
+    }
+    SliceStreamBuffer slice(output, skip, length);
+    std::ostream sliced(&slice);
+    return decodeBlocks(blocks, sliced, options) && sliced.flush();
+}
+
+
+// --- Code Table Implementation ---
+
+// Builds a table that gives every byte value a code. Counts are incremented
+// by one, so bytes missing from the samples still get codes, and scaled down
+// into the 32-bit range the tree is built in. Without a cap, lengths are
+// still held to what the decoder accepts.
+bool HuffmanCoder::buildCodeTable(const std::array<uint64_t, 256>& counts, int maxCodeLength, CodeTable& table) {
+    uint64_t total = 0;
+    for (uint64_t count : counts) {
+        total += count;
+    }
+    int shift = 0;
+    while ((total >> shift) + 256 > 0x7FFFFFFF) {
+        shift++;
+    }
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        frequencies[symbol] = (counts[symbol] >> shift) + 1;
+    }
+    if (!buildCanonicalCodes(maxCodeLength ? maxCodeLength : kMaxCodeLength)) {
+        return false;
+    }
+    table.codeLengths = codeLengths;
+    table.id = codeTableId(codeLengths);
+    return true;
+}
+
+// --- Public API ---
+
+// Runs a library call. A size that passes validation can still be more
+// memory than the system has to give, and a forged one may slip through;
+// running out fails the call like corrupt input instead of escaping to the
+// caller. The file functions report it.
+template <typename Call>
+static bool catchOutOfMemory(bool report, Call call) {
+    try {
+        return call();
+    } catch (const std::bad_alloc&) {
+        if (report) std::cerr << "Error: Out of memory." << std::endl;
+        return false;
+    }
+}
+
+HuffmanCoding::HuffmanCoding() : coder(new HuffmanCoder()) {}
+HuffmanCoding::~HuffmanCoding() = default;
+HuffmanCoding::HuffmanCoding(HuffmanCoding&&) noexcept = default;
+HuffmanCoding& HuffmanCoding::operator=(HuffmanCoding&&) noexcept = default;
+
+bool HuffmanCoding::compress(const std::string& inputFilePath, const std::string& outputFilePath,
+                             const CompressionOptions& options) {
+    return catchOutOfMemory(true, [&] { return coder->compress(inputFilePath, outputFilePath, options); });
+}
+
+bool HuffmanCoding::decompress(const std::string& inputFilePath, const std::string& outputFilePath,
+                               const DecompressionOptions& options) {
+    return catchOutOfMemory(true, [&] { return coder->decompress(inputFilePath, outputFilePath, options); });
+}
+
+bool HuffmanCoding::compress(const unsigned char* data, size_t size, std::vector<unsigned char>& output,
+                             const CompressionOptions& options) {
+    return catchOutOfMemory(false, [&] { return coder->compress(data, size, output, options); });
+}
+
+bool HuffmanCoding::decompress(const unsigned char* data, size_t size, std::vector<unsigned char>& output,
+                               const DecompressionOptions& options) {
+    return catchOutOfMemory(false, [&] { return coder->decompress(data, size, output, options); });
+}
+
+bool HuffmanCoding::decompress(std::istream& input, std::ostream& output, const DecompressionOptions& options) {
+    return catchOutOfMemory(false, [&] { return coder->decompress(input, output, options); });
+}
+
+bool HuffmanCoding::extract(const std::string& inputFilePath, const std::string& outputFilePath, uint64_t offset,
+                            uint64_t length, const DecompressionOptions& options) {
+    return catchOutOfMemory(true, [&] {
+        return coder->extract(inputFilePath, outputFilePath, offset, length, options);
+    });
+}
+
+bool HuffmanCoding::extract(const unsigned char* data, size_t size, uint64_t offset, uint64_t length,
+                            std::vector<unsigned char>& output, const DecompressionOptions& options) {
+    return catchOutOfMemory(false, [&] { return coder->extract(data, size, offset, length, output, options); });
+}
+
+void HuffmanCoding::setQuiet(bool enabled) { coder->setQuiet(enabled); }
+const PhaseTimes& HuffmanCoding::phaseTimes() const { return coder->phaseTimes(); }
+const CodingStats& HuffmanCoding::stats() const { return coder->codingStats(); }
+void HuffmanCoding::resetStats() { coder->resetStats(); }
+void HuffmanCoding::resetPhaseTimes() { coder->resetPhaseTimes(); }
+
+double CodingStats::averageCodeLength() const {
+    return symbolsEncoded ? double(bitsEncoded) / double(symbolsEncoded) : 0.0;
+}
+
+CodingStats& CodingStats::operator+=(const CodingStats& other) {
+    for (int phase = 0; phase < kPhaseCount; ++phase) {
+        seconds[phase] += other.seconds[phase];
+        calls[phase] += other.calls[phase];
+        bytesIn[phase] += other.bytesIn[phase];
+        bytesOut[phase] += other.bytesOut[phase];
+    }
+    symbolsEncoded += other.symbolsEncoded;
+    bitsEncoded += other.bitsEncoded;
+    symbolsDecoded += other.symbolsDecoded;
+    bitsDecoded += other.bitsDecoded;
+    blocks += other.blocks;
+    storedBlocks += other.storedBlocks;
+    contextBlocks += other.contextBlocks;
+    smallAlphabetBlocks += other.smallAlphabetBlocks;
+    repeatedTables += other.repeatedTables;
+    tableCacheHits += other.tableCacheHits;
+    tableCacheMisses += other.tableCacheMisses;
+    return *this;
+}
+
+std::string statsToJson(const CodingStats& stats) {
+    std::ostringstream json;
+    json << std::fixed << std::setprecision(6) << "{\"phases\": {";
+    for (int phase = 0; phase < kPhaseCount; ++phase) {
+        json << (phase ? ", " : "") << "\"" << kPhaseNames[phase] << "\": {\"seconds\": " << stats.seconds[phase]
+             << ", \"calls\": " << stats.calls[phase] << ", \"bytes_in\": " << stats.bytesIn[phase]
+             << ", \"bytes_out\": " << stats.bytesOut[phase] << "}";
+    }
+    json << "}, \"symbols_encoded\": " << stats.symbolsEncoded << ", \"bits_encoded\": " << stats.bitsEncoded
+         << ", \"average_code_length\": " << stats.averageCodeLength()
+         << ", \"symbols_decoded\": " << stats.symbolsDecoded << ", \"bits_decoded\": " << stats.bitsDecoded
+         << ", \"blocks\": " << stats.blocks << ", \"stored_blocks\": " << stats.storedBlocks
+         << ", \"context_blocks\": " << stats.contextBlocks
+         << ", \"small_alphabet_blocks\": " << stats.smallAlphabetBlocks
+         << ", \"repeated_tables\": " << stats.repeatedTables
+         << ", \"table_cache_hits\": " << stats.tableCacheHits
+         << ", \"table_cache_misses\": " << stats.tableCacheMisses
+         << "}";
+    return json.str();
+}
+
+std::string statsToPrometheus(const CodingStats& stats, const std::string& prefix) {
+    std::ostringstream text;
+    text << std::setprecision(9);
+    auto header = [&](const char* name, const char* type, const char* help) {
+        text << "# HELP " << prefix << "_" << name << " " << help << "\n";
+        text << "# TYPE " << prefix << "_" << name << " " << type << "\n";
+    };
+    auto perPhase = [&](const char* name, const char* help, auto value) {
+        header(name, "counter", help);
+        for (int phase = 0; phase < kPhaseCount; ++phase) {
+            text << prefix << "_" << name << "{phase=\"" << kPhaseNames[phase] << "\"} " << value(phase) << "\n";
+        }
+    };
+    auto single = [&](const char* name, const char* type, const char* help, auto value) {
+        header(name, type, help);
+        text << prefix << "_" << name << " " << value << "\n";
+    };
+    perPhase("phase_seconds_total", "Wall-clock time spent in each coding phase.",
+             [&](int phase) { return stats.seconds[phase]; });
+    perPhase("phase_calls_total", "Number of times each coding phase ran.",
+             [&](int phase) { return stats.calls[phase]; });
+    perPhase("phase_bytes_in_total", "Bytes consumed by each coding phase.",
+             [&](int phase) { return stats.bytesIn[phase]; });
+    perPhase("phase_bytes_out_total", "Bytes produced by each coding phase.",
+             [&](int phase) { return stats.bytesOut[phase]; });
+    single("symbols_encoded_total", "counter", "Symbols Huffman encoded.", stats.symbolsEncoded);
+    single("bits_encoded_total", "counter", "Payload bits of the encoded symbols.", stats.bitsEncoded);
+    single("average_code_length_bits", "gauge", "Average encoded code length.", stats.averageCodeLength());
+    single("symbols_decoded_total", "counter", "Symbols Huffman decoded.", stats.symbolsDecoded);
+    single("bits_decoded_total", "counter", "Payload bits of the decoded symbols.", stats.bitsDecoded);
+    single("blocks_total", "counter", "Blocks written by compression.", stats.blocks);
+    single("stored_blocks_total", "counter", "Blocks stored uncoded because coding did not pay off.",
+           stats.storedBlocks);
+    single("context_blocks_total", "counter", "Blocks coded with order-1 context tables.", stats.contextBlocks);
+    single("small_alphabet_blocks_total", "counter", "Blocks of at most four distinct bytes coded without a table.",
+           stats.smallAlphabetBlocks);
+    single("repeated_tables_total", "counter", "Blocks that reused the previous block's table.",
+           stats.repeatedTables);
+    single("table_cache_hits_total", "counter", "Decode tables copied from the table cache.", stats.tableCacheHits);
+    single("table_cache_misses_total", "counter", "Decode tables built because the table cache lacked them.",
+           stats.tableCacheMisses);
+    return text.str();
+}
+
+// The per-thread context behind the one-shot functions.
+static HuffmanCoder& threadCoder() {
+    thread_local HuffmanCoder coder;
+    return coder;
+}
+
+bool huffmanCompress(const unsigned char* data, size_t size, std::vector<unsigned char>& output,
+                     const CompressionOptions& options) {
+    return catchOutOfMemory(false, [&] { return threadCoder().compress(data, size, output, options); });
+}
+
+bool huffmanDecompress(const unsigned char* data, size_t size, std::vector<unsigned char>& output,
+                       const DecompressionOptions& options) {
+    return catchOutOfMemory(false, [&] { return threadCoder().decompress(data, size, output, options); });
+}
+
+bool huffmanExtract(const unsigned char* data, size_t size, uint64_t offset, uint64_t length,
+                    std::vector<unsigned char>& output, const DecompressionOptions& options) {
+    return catchOutOfMemory(false, [&] {
+        return threadCoder().extract(data, size, offset, length, output, options);
+    });
+}
+
+void CodeTableTrainer::add(const unsigned char* data, size_t size) {
+    uint64_t sample[256];
+    countFrequencies(data, size, sample);
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        counts[symbol] += sample[symbol];
+    }
+    total += size;
+}
+
+bool CodeTableTrainer::train(int maxCodeLength, CodeTable& table) const {
+    if (maxCodeLength && (maxCodeLength < kMinCodeLengthLimit || maxCodeLength > kMaxCodeLengthLimit)) {
+        return false;
+    }
+    std::unique_ptr<HuffmanCoder> coder(new HuffmanCoder());
+    return coder->buildCodeTable(counts, maxCodeLength, table);
+}
+
+bool saveCodeTable(const CodeTable& table, const std::string& path) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    file.write(kTableMagic, sizeof(kTableMagic));
+    file.put(static_cast<char>(kTableVersion));
+    for (int i = 0; i < 4; ++i) {
+        file.put(static_cast<char>(table.id >> (8 * i)));
+    }
+    file.write(reinterpret_cast<const char*>(table.codeLengths.data()), table.codeLengths.size());
+    file.close();
+    return static_cast<bool>(file);
+}
+
+bool loadCodeTable(const std::string& path, CodeTable& table) {
+    std::ifstream file(path, std::ios::binary);
+    unsigned char bytes[kTableFileSize + 1];
+    file.read(reinterpret_cast<char*>(bytes), sizeof(bytes));
+    if (static_cast<size_t>(file.gcount()) != kTableFileSize ||
+        !std::equal(kTableMagic, kTableMagic + sizeof(kTableMagic), reinterpret_cast<const char*>(bytes)) ||
+        bytes[sizeof(kTableMagic)] != kTableVersion) {
+        return false;
+    }
+    CodeTable loaded;
+    loaded.id = readUint32(bytes + sizeof(kTableMagic) + 1);
+    std::copy(bytes + kTableFileSize - 256, bytes + kTableFileSize, loaded.codeLengths.begin());
+
+    // Every byte needs a code, and the lengths must form a prefix code
+    // (Kraft's inequality, in units of the longest allowed code).
+    uint64_t kraft = 0;
+    for (uint8_t length : loaded.codeLengths) {
+        if (length == 0 || length > kMaxCodeLengthLimit) {
+            return false;
+        }
+        kraft += uint64_t(1) << (kMaxCodeLengthLimit - length);
+        if (kraft > uint64_t(1) << kMaxCodeLengthLimit) {
+            return false;
+        }
+    }
+    if (loaded.id != codeTableId(loaded.codeLengths)) {
+        return false;
+    }
+    table = loaded;
+    return true;
+}
@@ -0,0 +1,289 @@
+#ifndef HUFFMAN_H
+#define HUFFMAN_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+// --- Huffman Coding Library ---
+// Compresses and decompresses byte buffers or files. Output is either the
+// original frequency-table format or the canonical block container; both are
+// recognised automatically when decompressing.
+
+// --- Limits ---
+// Largest block either direction accepts, which bounds streaming memory.
+static constexpr size_t kMaxBlockSize = size_t(1) << 30;
+
+// Range accepted for a code length cap. Eight bits always leave room for a
+// full 256-symbol alphabet; the upper bound is the longest code the decoder
+// accepts anyway.
+static constexpr int kMinCodeLengthLimit = 8;
+static constexpr int kMaxCodeLengthLimit = 57;
+
+// Number of bitstreams in an interleaved block.
+static constexpr int kInterleavedStreams = 4;
+
+// --- Code Tables ---
+// A pre-trained code table for dictionary mode. Compressing with a table
+// skips building one per block and stores only the table's ID, so small
+// inputs pay neither the table-building time nor the table header;
+// decompressing needs the same table again.
+struct CodeTable {
+    // Derived from the code lengths, so different tables get different IDs.
+    uint32_t id = 0;
+    // Code length of every byte value. Trained tables give every byte a code,
+    // so any input can be coded with them.
+    std::array<uint8_t, 256> codeLengths{};
+};
+
+// Accumulates byte counts over a sample corpus and builds a code table from them.
+class CodeTableTrainer {
+public:
+    void add(const unsigned char* data, size_t size);
+    uint64_t sampleBytes() const { return total; }
+
+    // Builds the table. Bytes the samples never contain still get (long)
+    // codes. `maxCodeLength` caps the code lengths as for compression; zero
+    // leaves them unconstrained.
+    bool train(int maxCodeLength, CodeTable& table) const;
+
+private:
+    std::array<uint64_t, 256> counts{};
+    uint64_t total = 0;
+};
+
+// Writes or reads a table file. Loading checks that the table is complete
+// and matches its ID.
+bool saveCodeTable(const CodeTable& table, const std::string& path);
+bool loadCodeTable(const std::string& path, CodeTable& table);
+
+// --- Options ---
+// How the output file is written. Both settings fall back to plain buffered
+// writes where the file or the system does not support them.
+struct OutputOptions {
+    // Open the output with O_DIRECT, bypassing the page cache.
+    bool directIo = false;
+    // Write through io_uring (Linux), overlapping writes with coding.
+    bool ioUring = false;
+};
+
+// Settings that select the output format of compress().
+struct CompressionOptions {
+    // Write the canonical-code container instead of the original frequency-table format.
+    bool canonical = false;
+    // Split the input into independently coded blocks of this many bytes.
+    // Zero codes the whole input as one block. Implies the canonical container.
+    size_t blockSize = 0;
+    // Build one table from the whole input and share it between all blocks,
+    // instead of storing a table per block. Pays off for small blocks.
+    bool sharedTable = false;
+    // Worker threads for block coding; zero uses every available core.
+    unsigned threads = 0;
+    // Longest code allowed, in bits; zero leaves code lengths unconstrained.
+    // Implies the canonical container.
+    int maxCodeLength = 0;
+    // Bitstreams per block: 1, or kInterleavedStreams for interleaved blocks,
+    // which decode faster. More than one implies the canonical container.
+    int streams = 1;
+    // How the output file is written; ignored by the buffer API.
+    OutputOptions output;
+    // Code every block with this pre-trained table instead of building one.
+    // Implies the canonical container and overrides sharedTable and
+    // maxCodeLength. Must stay alive for the duration of the call.
+    const CodeTable* table = nullptr;
+    // Store a CRC32C of every block and of the whole input, which
+    // decompression verifies. Implies the canonical container.
+    bool checksum = false;
+    // Code each byte with a table chosen by the byte before it (order-1
+    // contexts, clustered into a few groups), for blocks where that beats a
+    // single table. Codes are then capped at 11 bits. Implies the canonical
+    // container; ignored with sharedTable or table.
+    bool contextModel = false;
+};
+
+// Size of the blocks compress() splits an input of `inputSize` bytes into in
+// the canonical container: options.blockSize, or the whole input when that
+// is zero, but never more than kMaxBlockSize, the most decompression accepts.
+size_t containerBlockSize(const CompressionOptions& options, uint64_t inputSize);
+
+// --- Decode Table Cache ---
+// Decode tables built for earlier inputs, kept so that decompressing another
+// input with the same code table copies them instead of parsing the table
+// and rebuilding them. Entries are keyed by the serialized table: the header
+// of an original-format input, or the code lengths of a canonical block,
+// which covers pre-trained tables too. Order-1 context tables are not
+// cached. When the cache is full, the least recently used entry is dropped.
+// One cache can be shared by any number of contexts and threads.
+class DecodeTableCache {
+public:
+    explicit DecodeTableCache(size_t capacity = 64);
+    ~DecodeTableCache();
+    DecodeTableCache(const DecodeTableCache&) = delete;
+    DecodeTableCache& operator=(const DecodeTableCache&) = delete;
+
+    // Number of tables held, and drops all of them.
+    size_t size() const;
+    void clear();
+
+private:
+    friend class HuffmanCoder;
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+// Settings for decompress().
+struct DecompressionOptions {
+    // Worker threads for block decoding, and for decoding the single
+    // bitstream of the original format; zero uses every available core.
+    unsigned threads = 0;
+    // How the output file is written; ignored by the buffer API.
+    OutputOptions output;
+    // Pre-trained tables that compressed input may refer to by ID.
+    std::vector<const CodeTable*> tables;
+    // Cache of built decode tables to look tables up in and add them to;
+    // none by default. Must stay alive for the duration of the call.
+    DecodeTableCache* tableCache = nullptr;
+};
+
+// --- Phase Timing ---
+// Wall-clock time spent in each coding phase, accumulated over every block a
+// context handles.
+enum Phase : int {
+    kPhaseFrequencyTable,
+    kPhaseTree,
+    kPhaseCodes,
+    kPhaseHeader,
+    kPhaseData,
+    kPhaseDecodeTables,
+    kPhaseDecode,
+    kPhaseChecksum,
+    kPhaseCount,
+};
+static const char* const kPhaseNames[kPhaseCount] = {
+    "table", "tree", "codes", "header", "data", "decode_tables", "decode", "checksum",
+};
+using PhaseTimes = std::array<double, kPhaseCount>;
+
+// --- Statistics ---
+// Counters a context keeps alongside its phase times. Collecting them is
+// silent and cheap; nothing is printed unless the caller exports them.
+struct CodingStats {
+    // Wall time, number of runs, and bytes consumed and produced per phase.
+    PhaseTimes seconds{};
+    std::array<uint64_t, kPhaseCount> calls{};
+    std::array<uint64_t, kPhaseCount> bytesIn{};
+    std::array<uint64_t, kPhaseCount> bytesOut{};
+    // Symbols coded and the payload bits they took, per direction.
+    uint64_t symbolsEncoded = 0;
+    uint64_t bitsEncoded = 0;
+    uint64_t symbolsDecoded = 0;
+    uint64_t bitsDecoded = 0;
+    // Blocks written by compression, how many of them were stored uncoded,
+    // how many were coded with order-1 contexts, how many held at most four
+    // distinct bytes and were coded without a table, and how many reused the
+    // previous block's table instead of storing their own.
+    uint64_t blocks = 0;
+    uint64_t storedBlocks = 0;
+    uint64_t contextBlocks = 0;
+    uint64_t smallAlphabetBlocks = 0;
+    uint64_t repeatedTables = 0;
+    // Decode tables taken from a DecodeTableCache, and those built and added
+    // to it because it did not hold them.
+    uint64_t tableCacheHits = 0;
+    uint64_t tableCacheMisses = 0;
+
+    // Average encoded code length in bits, or zero before anything was encoded.
+    double averageCodeLength() const;
+    CodingStats& operator+=(const CodingStats& other);
+};
+
+// Renders statistics as a JSON object, or in the Prometheus text exposition
+// format with every metric name starting with `prefix`.
+std::string statsToJson(const CodingStats& stats);
+std::string statsToPrometheus(const CodingStats& stats, const std::string& prefix = "huffman");
+
+class HuffmanCoder;
+
+// --- Huffman Coding Context ---
+// A reusable compression and decompression context. It owns the frequency,
+// code and decode tables (and the worker contexts for multi-threaded block
+// coding), so repeated calls on one context do not reallocate them. Every
+// call starts from a clean state. A context must not be used by two threads
+// at once; give each thread its own.
+class HuffmanCoding {
+public:
+    HuffmanCoding();
+    ~HuffmanCoding();
+    HuffmanCoding(HuffmanCoding&&) noexcept;
+    HuffmanCoding& operator=(HuffmanCoding&&) noexcept;
+
+    // Compresses a file; "-" selects stdin or stdout. Reports errors on
+    // stderr, and progress, if enabled, on stdout (stderr when writing
+    // stdout). Returns false on failure.
+    bool compress(const std::string& inputFilePath, const std::string& outputFilePath,
+                  const CompressionOptions& options = CompressionOptions());
+
+    // Decompresses a file; "-" selects stdin or stdout. Returns false on failure.
+    bool decompress(const std::string& inputFilePath, const std::string& outputFilePath,
+                    const DecompressionOptions& options = DecompressionOptions());
+
+    // Compresses `size` bytes at `data`, replacing the contents of `output`.
+    // Never prints; returns false if the input cannot be coded.
+    bool compress(const unsigned char* data, size_t size, std::vector<unsigned char>& output,
+                  const CompressionOptions& options = CompressionOptions());
+
+    // Decompresses `size` bytes at `data`, replacing the contents of `output`.
+    // Never prints; returns false if the input is corrupt or truncated.
+    bool decompress(const unsigned char* data, size_t size, std::vector<unsigned char>& output,
+                    const DecompressionOptions& options = DecompressionOptions());
+
+    // Decompresses a stream, such as a pipe, holding one block of the
+    // canonical container in memory at a time; original-format input is
+    // read in full. Never prints; returns false if the input is corrupt or
+    // truncated, with whatever decoded before the damage already written.
+    bool decompress(std::istream& input, std::ostream& output,
+                    const DecompressionOptions& options = DecompressionOptions());
+
+    // Decompresses only the original bytes [offset, offset + length) of a
+    // file, cut short at the end of the data. In the canonical container only
+    // the blocks overlapping the range are decoded, found through the block
+    // index; other input is decoded from the start. Returns false on failure.
+    bool extract(const std::string& inputFilePath, const std::string& outputFilePath, uint64_t offset,
+                 uint64_t length, const DecompressionOptions& options = DecompressionOptions());
+
+    // Buffer form of extract(), replacing the contents of `output`. Never prints.
+    bool extract(const unsigned char* data, size_t size, uint64_t offset, uint64_t length,
+                 std::vector<unsigned char>& output, const DecompressionOptions& options = DecompressionOptions());
+
+    // Turns the progress messages of the file functions on or off. They are
+    // off by default; errors are always reported on stderr.
+    void setQuiet(bool enabled);
+
+    // Time spent in each phase, and the other counters, since the last reset,
+    // summed over all worker threads. resetStats() clears all of them;
+    // resetPhaseTimes() clears only the times, as it did before the other
+    // counters existed.
+    const PhaseTimes& phaseTimes() const;
+    const CodingStats& stats() const;
+    void resetStats();
+    void resetPhaseTimes();
+
+private:
+    std::unique_ptr<HuffmanCoder> coder;
+};
+
+// --- One-Shot Buffer Functions ---
+// Stateless from the caller's point of view: each thread keeps a private
+// context that these reuse, so they are safe to call concurrently.
+bool huffmanCompress(const unsigned char* data, size_t size, std::vector<unsigned char>& output,
+                     const CompressionOptions& options = CompressionOptions());
+bool huffmanDecompress(const unsigned char* data, size_t size, std::vector<unsigned char>& output,
+                       const DecompressionOptions& options = DecompressionOptions());
+bool huffmanExtract(const unsigned char* data, size_t size, uint64_t offset, uint64_t length,
+                    std::vector<unsigned char>& output, const DecompressionOptions& options = DecompressionOptions());
+
+#endif // HUFFMAN_H
@@ -0,0 +1,360 @@
+#include "batch.h"
+#include "bench.h"
+#include "huffman.h"
+
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// --- Main Program ---
+void showUsage() {
+    std::cout << "Usage: huffman <command> [options] <input_file> <output_file>" << std::endl;
+    std::cout << "       huffman bench [options] [file...]" << std::endl;
+    std::cout << "       huffman batch [options] <directory|manifest> <output_directory>" << std::endl;
+    std::cout << "       huffman extract --offset <n> [--length <n>] [options] <input_file> <output_file>" << std::endl;
+    std::cout << "       huffman train [--max-code-length <n>] <sample>... <table_file>" << std::endl;
+    std::cout << "Use - as <input_file> or <output_file> to read stdin or write stdout." << std::endl;
+    std::cout << "Commands:" << std::endl;
+    std::cout << "  c, compress      Compress the input file." << std::endl;
+    std::cout << "  d, decompress    Decompress the input file." << std::endl;
+    std::cout << "  extract          Decompress only a byte range, decoding just the blocks it overlaps." << std::endl;
+    std::cout << "  bench            Time compress and decompress over a generated corpus and any given files." << std::endl;
+    std::cout << "  batch            Compress every file below a directory, or listed in a manifest, on a thread pool." << std::endl;
+    std::cout << "  train            Build a code table from sample files or directories, for --table." << std::endl;
+    std::cout << "Compression options:" << std::endl;
+    std::cout << "  --canonical             Use canonical codes with a compact code-length header." << std::endl;
+    std::cout << "  --block-size <size>     Code the input in independent blocks (e.g. 4M, 512K; default unit MiB)." << std::endl;
+    std::cout << "  --shared-table          Share one code table between all blocks." << std::endl;
+    std::cout << "  --max-code-length <n>   Cap code lengths at n bits (8-57), at a small cost in ratio." << std::endl;
+    std::cout << "  --streams <n>           Bitstreams per block: 1 or 4 (4 decodes faster)." << std::endl;
+    std::cout << "  --table <file>          Code with a table made by train instead of storing one per file." << std::endl;
+    std::cout << "  --checksum              Store CRC32C checksums, verified when decompressing." << std::endl;
+    std::cout << "  --context               Code each byte with a table chosen by the byte before it." << std::endl;
+    std::cout << "Extract options:" << std::endl;
+    std::cout << "  --offset <n>            First byte of the range, in bytes of the original data." << std::endl;
+    std::cout << "  --length <n>            Bytes to extract (default: up to the end)." << std::endl;
+    std::cout << "Common options:" << std::endl;
+    std::cout << "  --threads <n>           Worker threads for block coding, or files coded at once by batch (default: all cores)." << std::endl;
+    std::cout << "  --table <file>          When decompressing, a table compressed files may refer to (repeatable)." << std::endl;
+    std::cout << "  --quiet                 Do not print progress messages." << std::endl;
+    std::cout << "  --stats <format>        Export per-phase timings and counters as json or prometheus." << std::endl;
+    std::cout << "  --stats-file <path>     Write the statistics to a file instead of stderr." << std::endl;
+    std::cout << "  --direct-io             Write the output file with O_DIRECT, bypassing the page cache." << std::endl;
+    std::cout << "  --io-uring              Write the output file through io_uring (Linux)." << std::endl;
+    std::cout << "Bench options:" << std::endl;
+    std::cout << "  --corpus <list>         Comma-separated kinds: text,binary,random,single,empty (default: all)." << std::endl;
+    std::cout << "  --size <size>           Size of each generated corpus (default: 8M)." << std::endl;
+    std::cout << "  --repeat <n>            Runs per case; the fastest is reported (default: 3)." << std::endl;
+    std::cout << "  --json                  Print the results as JSON." << std::endl;
+}
+
+// Parses a size such as "4", "4M" or "512K". A bare number is in MiB.
+static bool parseSize(const std::string& text, size_t& size) {
+    size_t pos = 0;
+    unsigned long long value;
+    try {
+        value = std::stoull(text, &pos);
+    } catch (const std::exception&) {
+        return false;
+    }
+    std::string suffix = text.substr(pos);
+    if (suffix.empty() || suffix == "M" || suffix == "m") {
+        value <<= 20;
+    } else if (suffix == "K" || suffix == "k") {
+        value <<= 10;
+    } else {
+        return false;
+    }
+    size = static_cast<size_t>(value);
+    return size > 0;
+}
+
+// Parses a byte count or position, which has no unit suffix.
+static bool parseBytes(const std::string& text, uint64_t& value) {
+    size_t pos = 0;
+    try {
+        value = std::stoull(text, &pos);
+    } catch (const std::exception&) {
+        return false;
+    }
+    return pos == text.size() && text[0] != '-';
+}
+
+// Counts every sample (regular files, or every file below a directory) and
+// writes the trained table to `tablePath`.
+static int trainTable(const std::vector<std::string>& samples, const std::string& tablePath, int maxCodeLength) {
+    CodeTableTrainer trainer;
+    std::vector<unsigned char> buffer(size_t(1) << 20);
+    size_t files = 0;
+    auto addFile = [&](const std::filesystem::path& path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            std::cerr << "Error: Could not open input file: " << path.string() << std::endl;
+            return false;
+        }
+        while (file.read(reinterpret_cast<char*>(buffer.data()), buffer.size()) || file.gcount() > 0) {
+            trainer.add(buffer.data(), static_cast<size_t>(file.gcount()));
+        }
+        files++;
+        return true;
+    };
+    for (const std::string& sample : samples) {
+        std::error_code error;
+        if (!std::filesystem::is_directory(sample, error)) {
+            if (!addFile(sample)) return 1;
+            continue;
+        }
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(
+                 sample, std::filesystem::directory_options::skip_permission_denied, error)) {
+            if (entry.is_regular_file(error) && !addFile(entry.path())) return 1;
+        }
+    }
+
+    CodeTable table;
+    if (!trainer.train(maxCodeLength, table) || !saveCodeTable(table, tablePath)) {
+        std::cerr << "Error: Could not write code table: " << tablePath << std::endl;
+        return 1;
+    }
+    std::cout << "Trained code table " << std::hex << std::setw(8) << std::setfill('0') << table.id << std::dec
+              << " on " << files << " file(s), " << trainer.sampleBytes() << " bytes." << std::endl;
+    return 0;
+}
+
+// Writes `stats` in `format` to `path`, or to stderr when no path is given.
+static bool exportStats(const CodingStats& stats, const std::string& format, const std::string& path) {
+    std::string text = format == "json" ? statsToJson(stats) + "\n" : statsToPrometheus(stats);
+    if (path.empty()) {
+        std::cerr << text;
+        return true;
+    }
+    std::ofstream file(path);
+    file << text;
+    file.close();
+    if (!file) {
+        std::cerr << "Error: Could not write statistics file: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    // stdin/stdout carry binary data when "-" is given as a path.
+    std::ios::sync_with_stdio(false);
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    if (argc < 2) {
+        showUsage();
+        return 1;
+    }
+
+    std::string command = argv[1];
+    bool isBench = command == "bench";
+    bool isExtract = command == "extract";
+    uint64_t extractOffset = 0;
+    uint64_t extractLength = UINT64_MAX;
+    bool hasOffset = false;
+    CompressionOptions options;
+    DecompressionOptions decompressOptions;
+    BenchOptions bench;
+    std::vector<std::string> paths;
+    std::vector<std::string> tablePaths;
+    bool quiet = false;
+    std::string statsFormat, statsPath;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--canonical") {
+            options.canonical = true;
+        } else if (arg == "--shared-table") {
+            options.sharedTable = true;
+        } else if (arg == "--checksum") {
+            options.checksum = true;
+        } else if (arg == "--context") {
+            options.contextModel = true;
+        } else if (arg == "--block-size" && hasValue) {
+            if (!parseSize(argv[++i], options.blockSize) || options.blockSize > kMaxBlockSize) {
+                std::cerr << "Error: Invalid block size '" << argv[i] << "'" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--max-code-length" && hasValue) {
+            int limit = 0;
+            try {
+                limit = std::stoi(argv[++i]);
+            } catch (const std::exception&) {
+            }
+            if (limit < kMinCodeLengthLimit || limit > kMaxCodeLengthLimit) {
+                std::cerr << "Error: Invalid code length cap '" << argv[i] << "' (must be " << kMinCodeLengthLimit
+                          << "-" << kMaxCodeLengthLimit << ")" << std::endl;
+                return 1;
+            }
+            options.maxCodeLength = limit;
+        } else if (arg == "--streams" && hasValue) {
+            std::string streams = argv[++i];
+            if (streams != "1" && streams != std::to_string(kInterleavedStreams)) {
+                std::cerr << "Error: Invalid stream count '" << streams << "' (must be 1 or " << kInterleavedStreams
+                          << ")" << std::endl;
+                return 1;
+            }
+            options.streams = std::stoi(streams);
+        } else if (arg == "--threads" && hasValue) {
+            size_t threads = 0;
+            try {
+                threads = std::stoul(argv[++i]);
+            } catch (const std::exception&) {
+            }
+            if (threads == 0) {
+                std::cerr << "Error: Invalid thread count '" << argv[i] << "'" << std::endl;
+                return 1;
+            }
+            options.threads = decompressOptions.threads = static_cast<unsigned>(threads);
+        } else if (arg == "--quiet") {
+            quiet = true;
+        } else if (arg == "--stats" && hasValue) {
+            statsFormat = argv[++i];
+            if (statsFormat != "json" && statsFormat != "prometheus") {
+                std::cerr << "Error: Invalid statistics format '" << statsFormat << "' (must be json or prometheus)"
+                          << std::endl;
+                return 1;
+            }
+        } else if (arg == "--stats-file" && hasValue) {
+            statsPath = argv[++i];
+        } else if (arg == "--table" && hasValue) {
+            tablePaths.push_back(argv[++i]);
+        } else if (arg == "--direct-io") {
+            options.output.directIo = decompressOptions.output.directIo = true;
+        } else if (arg == "--io-uring") {
+            options.output.ioUring = decompressOptions.output.ioUring = true;
+        } else if (isExtract && (arg == "--offset" || arg == "--length") && hasValue) {
+            if (!parseBytes(argv[++i], arg == "--offset" ? extractOffset : extractLength)) {
+                std::cerr << "Error: Invalid " << arg.substr(2) << " '" << argv[i] << "'" << std::endl;
+                return 1;
+            }
+            hasOffset = hasOffset || arg == "--offset";
+        } else if (isBench && arg == "--json") {
+            bench.json = true;
+        } else if (isBench && arg == "--corpus" && hasValue) {
+            bench.corpora.clear();
+            std::stringstream list(argv[++i]);
+            for (std::string kind; std::getline(list, kind, ',');) {
+                if (!kind.empty()) bench.corpora.push_back(kind);
+            }
+        } else if (isBench && arg == "--size" && hasValue) {
+            if (!parseSize(argv[++i], bench.size) || bench.size > kMaxBlockSize) {
+                std::cerr << "Error: Invalid corpus size '" << argv[i] << "'" << std::endl;
+                return 1;
+            }
+        } else if (isBench && arg == "--repeat" && hasValue) {
+            size_t repeat = 0;
+            try {
+                repeat = std::stoul(argv[++i]);
+            } catch (const std::exception&) {
+            }
+            if (repeat == 0) {
+                std::cerr << "Error: Invalid repeat count '" << argv[i] << "'" << std::endl;
+                return 1;
+            }
+            bench.repeat = static_cast<unsigned>(repeat);
+        } else if (arg.rfind("--", 0) == 0) {
+            std::cerr << "Error: Unknown option '" << arg << "'" << std::endl;
+            showUsage();
+            return 1;
+        } else {
+            paths.push_back(arg);
+        }
+    }
+    if (command == "train") {
+        if (paths.size() < 2) {
+            showUsage();
+            return 1;
+        }
+        std::string tablePath = paths.back();
+        paths.pop_back();
+        return trainTable(paths, tablePath, options.maxCodeLength);
+    }
+
+    // Compression uses the last table given; decompression may need any of them.
+    std::vector<CodeTable> tables(tablePaths.size());
+    for (size_t i = 0; i < tablePaths.size(); ++i) {
+        if (!loadCodeTable(tablePaths[i], tables[i])) {
+            std::cerr << "Error: Invalid code table file: " << tablePaths[i] << std::endl;
+            return 1;
+        }
+        decompressOptions.tables.push_back(&tables[i]);
+    }
+    if (!tables.empty()) {
+        if (options.sharedTable) {
+            std::cerr << "Error: --table cannot be combined with --shared-table." << std::endl;
+            return 1;
+        }
+        options.table = &tables.back();
+    }
+
+    if (isBench) {
+        bench.files = paths;
+        return runBench(bench, options, decompressOptions);
+    }
+    if (paths.size() != 2) {
+        showUsage();
+        return 1;
+    }
+    if (statsFormat.empty() && !statsPath.empty()) {
+        statsFormat = "prometheus";
+    }
+    if (command == "batch") {
+        BatchOptions batch;
+        batch.source = paths[0];
+        batch.outputDirectory = paths[1];
+        CodingStats stats;
+        int status = runBatch(batch, options, stats);
+        if (!statsFormat.empty() && !exportStats(stats, statsFormat, statsPath)) {
+            return 1;
+        }
+        return status;
+    }
+    std::string inputFile = paths[0];
+    std::string outputFile = paths[1];
+
+    HuffmanCoding hf;
+    hf.setQuiet(quiet);
+
+    bool succeeded;
+    if (command == "c" || command == "compress") {
+        succeeded = hf.compress(inputFile, outputFile, options);
+    } else if (command == "d" || command == "decompress") {
+        succeeded = hf.decompress(inputFile, outputFile, decompressOptions);
+    } else if (isExtract) {
+        if (!hasOffset) {
+            std::cerr << "Error: extract needs --offset." << std::endl;
+            return 1;
+        }
+        succeeded = hf.extract(inputFile, outputFile, extractOffset, extractLength, decompressOptions);
+    } else {
+        std::cerr << "Error: Invalid command '" << command << "'" << std::endl;
+        showUsage();
+        return 1;
+    }
+    // Output decoded from corrupt or truncated input is incomplete or wrong,
+    // so it is not left behind.
+    if (!succeeded && command != "c" && command != "compress" && outputFile != "-") {
+        std::error_code error;
+        std::filesystem::remove(outputFile, error);
+    }
+    if (!statsFormat.empty() && !exportStats(hf.stats(), statsFormat, statsPath)) {
+        return 1;
+    }
+
+    return succeeded ? 0 : 1;
+}
@@ -0,0 +1,475 @@
+#include "output_sink.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define OUTPUT_SINK_POSIX 1
+#endif
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(__linux__) && defined(OUTPUT_SINK_POSIX) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define OUTPUT_SINK_IO_URING 1
+#endif
+
+namespace {
+
+// Size of each output buffer, and the alignment O_DIRECT needs for buffer
+// addresses, write sizes and file offsets.
+constexpr size_t kSinkBufferSize = size_t(1) << 20;
+constexpr size_t kSinkAlignment = 4096;
+
+} // namespace
+
+// One page-aligned output buffer. With io_uring, it also records the write
+// it was submitted in until that write completes.
+struct OutputSink::Buffer {
+    char* raw = nullptr;
+    char* data = nullptr;
+    bool inFlight = false;
+    size_t size = 0;
+    uint64_t offset = 0;
+
+    bool allocate() {
+        raw = static_cast<char*>(std::malloc(kSinkBufferSize + kSinkAlignment));
+        if (!raw) return false;
+        uintptr_t address = reinterpret_cast<uintptr_t>(raw);
+        data = raw + (kSinkAlignment - address % kSinkAlignment) % kSinkAlignment;
+        return true;
+    }
+    ~Buffer() { std::free(raw); }
+};
+
+#ifdef OUTPUT_SINK_IO_URING
+// --- io_uring Ring ---
+// A minimal ring for asynchronous file writes, driven through the raw system
+// calls so there is no liburing dependency. The sink is its only user, so
+// submissions and completions need no locking; the barriers only order the
+// ring indices against the kernel.
+class OutputSink::Uring {
+public:
+    ~Uring() {
+        if (sqes != MAP_FAILED) munmap(sqes, sqesSize);
+        if (cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqRingSize);
+        if (sqRing != MAP_FAILED) munmap(sqRing, sqRingSize);
+        if (ringFd >= 0) ::close(ringFd);
+    }
+
+    // Creates a ring with room for `entries` writes. Returns false where the
+    // kernel does not provide io_uring (or forbids it).
+    bool setup(unsigned entries) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        ringFd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (ringFd < 0) return false;
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMap) {
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        }
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                      IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED) return false;
+        cqRing = singleMap ? sqRing
+                           : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                                  IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) return false;
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        void* entriesMap = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                                IORING_OFF_SQES);
+        if (entriesMap == MAP_FAILED) return false;
+        sqes = static_cast<io_uring_sqe*>(entriesMap);
+
+        char* sq = static_cast<char*>(sqRing);
+        char* cq = static_cast<char*>(cqRing);
+        sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        sqEntries = params.sq_entries;
+        return true;
+    }
+
+    // Queues and submits a write of `size` bytes at `offset`, tagged `tag`.
+    bool submitWrite(int fd, const char* data, size_t size, uint64_t offset, uint64_t tag) {
+        unsigned tail = *sqTail;
+        if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) return false;
+        unsigned index = tail & *sqMask;
+        io_uring_sqe& entry = sqes[index];
+        std::memset(&entry, 0, sizeof(entry));
+        entry.opcode = IORING_OP_WRITE;
+        entry.fd = fd;
+        entry.addr = reinterpret_cast<uint64_t>(data);
+        entry.len = static_cast<uint32_t>(size);
+        entry.off = offset;
+        entry.user_data = tag;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        for (;;) {
+            long submitted = syscall(__NR_io_uring_enter, ringFd, 1, 0, 0, nullptr, 0);
+            if (submitted == 1) return true;
+            if (submitted < 0 && errno != EINTR) return false;
+        }
+    }
+
+    // Waits for the next completion; `result` is the byte count or -errno.
+    bool waitCompletion(uint64_t& tag, int& result) {
+        for (;;) {
+            unsigned head = *cqHead;
+            if (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+                const io_uring_cqe& completion = cqes[head & *cqMask];
+                tag = completion.user_data;
+                result = completion.res;
+                __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+            if (syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 &&
+                errno != EINTR) {
+                return false;
+            }
+        }
+    }
+
+private:
+    int ringFd = -1;
+    void* sqRing = MAP_FAILED;
+    void* cqRing = MAP_FAILED;
+    size_t sqRingSize = 0;
+    size_t cqRingSize = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqesSize = 0;
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    unsigned sqEntries = 0;
+};
+#else
+// Without io_uring support the ring never comes up, so the sink always
+// writes synchronously.
+class OutputSink::Uring {
+public:
+    bool setup(unsigned) { return false; }
+    bool submitWrite(int, const char*, size_t, uint64_t, uint64_t) { return false; }
+    bool waitCompletion(uint64_t&, int&) { return false; }
+};
+#endif
+
+OutputSink::OutputSink() = default;
+
+OutputSink::~OutputSink() {
+    close();
+}
+
+bool OutputSink::open(const std::string& path, const OutputOptions& options) {
+    close();
+    failed = false;
+    direct = false;
+    fileOffset = 0;
+    current = 0;
+    if (path == "-") {
+        fd = 1;
+        ownsFd = false;
+    } else {
+#ifdef OUTPUT_SINK_POSIX
+        int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+        if (options.directIo) {
+            fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+            direct = fd >= 0;
+        }
+#endif
+        if (fd < 0) {
+            fd = ::open(path.c_str(), flags, 0644);
+        }
+#ifdef F_NOCACHE
+        // macOS has no O_DIRECT; F_NOCACHE bypasses the cache without alignment rules.
+        if (fd >= 0 && options.directIo) {
+            fcntl(fd, F_NOCACHE, 1);
+        }
+#endif
+#else
+        fd = _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#endif
+        if (fd < 0) return false;
+        ownsFd = true;
+    }
+
+    // Only regular files buffer across stream flushes and take positioned
+    // io_uring writes; anything else is written through as it is flushed.
+    struct stat info;
+    streaming = !(fstat(fd, &info) == 0 && (info.st_mode & S_IFMT) == S_IFREG);
+    if (streaming && direct) {
+        disableDirect();
+    }
+    if (options.ioUring && !streaming) {
+        uring.reset(new Uring());
+        if (!uring->setup(2)) {
+            uring.reset();
+        }
+    }
+
+    int bufferCount = uring ? 2 : 1;
+    buffers.reset(new Buffer[bufferCount]);
+    for (int i = 0; i < bufferCount; ++i) {
+        if (!buffers[i].allocate()) {
+            close();
+            return false;
+        }
+    }
+    resetPutArea(0);
+    return true;
+}
+
+bool OutputSink::close() {
+    if (fd < 0) {
+        return !failed;
+    }
+    bool ok = flush(true);
+    if (ownsFd) {
+#ifdef OUTPUT_SINK_POSIX
+        ok = ::close(fd) == 0 && ok;
+#else
+        ok = _close(fd) == 0 && ok;
+#endif
+    }
+    fd = -1;
+    uring.reset();
+    buffers.reset();
+    setp(nullptr, nullptr);
+    failed = !ok;
+    return ok;
+}
+
+std::streambuf::int_type OutputSink::overflow(int_type c) {
+    if (!flush(false)) {
+        return traits_type::eof();
+    }
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+std::streamsize OutputSink::xsputn(const char* data, std::streamsize count) {
+    if (failed || !buffers) {
+        return 0;
+    }
+    size_t remaining = static_cast<size_t>(count);
+
+    // A write at least a buffer long goes out with the pending bytes in one
+    // vectored call rather than being copied. O_DIRECT and io_uring need the
+    // data in the aligned buffers, so they always copy.
+    if (remaining >= kSinkBufferSize && !direct && !uring) {
+        size_t pending = static_cast<size_t>(pptr() - pbase());
+        if (!writeVectored(pbase(), pending, data, remaining)) {
+            failed = true;
+            return 0;
+        }
+        resetPutArea(0);
+        return count;
+    }
+
+    while (remaining > 0) {
+        size_t space = static_cast<size_t>(epptr() - pptr());
+        if (space == 0) {
+            if (!flush(false)) break;
+            continue;
+        }
+        size_t chunk = std::min(space, remaining);
+        std::memcpy(pptr(), data, chunk);
+        pbump(static_cast<int>(chunk));
+        data += chunk;
+        remaining -= chunk;
+    }
+    return count - static_cast<std::streamsize>(remaining);
+}
+
+int OutputSink::sync() {
+    if (!streaming) {
+        return failed ? -1 : 0;
+    }
+    return flush(false) ? 0 : -1;
+}
+
+// Writes out the buffered bytes. Under O_DIRECT only whole aligned chunks can
+// be written; the unaligned rest moves to the front of the buffer, or, when
+// `final` is set, is written after O_DIRECT is switched off. With io_uring
+// the buffer is submitted and filling continues in the other buffer.
+bool OutputSink::flush(bool final) {
+    if (failed || !buffers) {
+        return false;
+    }
+    char* base = pbase();
+    size_t pending = static_cast<size_t>(pptr() - base);
+    size_t writable = direct ? pending / kSinkAlignment * kSinkAlignment : pending;
+
+    if (final) {
+        bool ok = !uring || (waitFor(0) && waitFor(1));
+        ok = ok && writeAll(base, writable);
+        if (ok && writable < pending) {
+            ok = disableDirect() && writeAll(base + writable, pending - writable);
+        }
+        resetPutArea(0);
+        failed = !ok;
+        return ok;
+    }
+
+    if (uring && writable > 0) {
+        Buffer& buffer = buffers[current];
+        buffer.size = writable;
+        buffer.offset = fileOffset;
+        if (uring->submitWrite(fd, base, writable, fileOffset, static_cast<uint64_t>(current))) {
+            buffer.inFlight = true;
+            fileOffset += writable;
+            int next = current ^ 1;
+            if (!waitFor(next)) {
+                failed = true;
+                return false;
+            }
+            std::memcpy(buffers[next].data, base + writable, pending - writable);
+            current = next;
+            resetPutArea(pending - writable);
+            return true;
+        }
+        // The ring is full or gone: finish what is in flight and go synchronous.
+        if (!waitFor(0) || !waitFor(1)) {
+            failed = true;
+            return false;
+        }
+        uring.reset();
+    }
+
+    if (!writeAll(base, writable)) {
+        failed = true;
+        return false;
+    }
+    std::memmove(base, base + writable, pending - writable);
+    resetPutArea(pending - writable);
+    return true;
+}
+
+// Writes `size` bytes synchronously, retrying short writes. With io_uring the
+// file offset is tracked explicitly, so positioned writes are used.
+bool OutputSink::writeAll(const char* data, size_t size) {
+    while (size > 0) {
+#ifdef OUTPUT_SINK_POSIX
+        ssize_t written = uring ? pwrite(fd, data, size, static_cast<off_t>(fileOffset)) : ::write(fd, data, size);
+        if (written < 0 && errno == EINTR) continue;
+        if (written < 0 && errno == EINVAL && direct && disableDirect()) continue;
+#else
+        int written = _write(fd, data, static_cast<unsigned>(std::min<size_t>(size, 1u << 30)));
+#endif
+        if (written <= 0) return false;
+        data += written;
+        size -= static_cast<size_t>(written);
+        fileOffset += static_cast<uint64_t>(written);
+    }
+    return true;
+}
+
+// Writes two ranges back to back with as few system calls as possible.
+bool OutputSink::writeVectored(const char* first, size_t firstSize, const char* second, size_t secondSize) {
+#ifdef OUTPUT_SINK_POSIX
+    while (firstSize > 0) {
+        iovec parts[2] = {{const_cast<char*>(first), firstSize}, {const_cast<char*>(second), secondSize}};
+        ssize_t written = ::writev(fd, parts, 2);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        fileOffset += static_cast<uint64_t>(written);
+        size_t fromFirst = std::min(firstSize, static_cast<size_t>(written));
+        first += fromFirst;
+        firstSize -= fromFirst;
+        second += static_cast<size_t>(written) - fromFirst;
+        secondSize -= static_cast<size_t>(written) - fromFirst;
+    }
+#else
+    if (!writeAll(first, firstSize)) return false;
+#endif
+    return writeAll(second, secondSize);
+}
+
+// Waits until buffer `index` is no longer being written. A write that came
+// back short is finished synchronously; one that O_DIRECT rejected is retried
+// without it.
+bool OutputSink::waitFor(int index) {
+    while (uring && buffers[index].inFlight) {
+        uint64_t tag;
+        int result;
+        if (!uring->waitCompletion(tag, result) || tag > 1) {
+            return false;
+        }
+        Buffer& done = buffers[tag];
+        done.inFlight = false;
+        size_t written = result > 0 ? static_cast<size_t>(result) : 0;
+        if (result == -EINVAL && direct && !disableDirect()) {
+            return false;
+        }
+        if (result < 0 && result != -EINVAL) {
+            return false;
+        }
+        if (written < done.size) {
+#ifdef OUTPUT_SINK_POSIX
+            const char* data = done.data + written;
+            size_t size = done.size - written;
+            uint64_t offset = done.offset + written;
+            while (size > 0) {
+                ssize_t retried = pwrite(fd, data, size, static_cast<off_t>(offset));
+                if (retried < 0 && errno == EINTR) continue;
+                if (retried < 0 && errno == EINVAL && direct && disableDirect()) continue;
+                if (retried <= 0) return false;
+                data += retried;
+                size -= static_cast<size_t>(retried);
+                offset += static_cast<uint64_t>(retried);
+            }
+#endif
+        }
+    }
+    return true;
+}
+
+// Switches the file back to cached writes so unaligned data can be written.
+bool OutputSink::disableDirect() {
+#if defined(OUTPUT_SINK_POSIX) && defined(O_DIRECT)
+    if (direct) {
+        int flags = fcntl(fd, F_GETFL);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags & ~O_DIRECT) < 0) {
+            return false;
+        }
+    }
+#endif
+    direct = false;
+    return true;
+}
+
+// Points the put area at the current buffer, keeping its first `keep` bytes.
+void OutputSink::resetPutArea(size_t keep) {
+    char* base = buffers[current].data;
+    setp(base, base + kSinkBufferSize);
+    pbump(static_cast<int>(keep));
+}
@@ -0,0 +1,65 @@
+#ifndef OUTPUT_SINK_H
+#define OUTPUT_SINK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <streambuf>
+#include <string>
+
+#include "huffman.h"
+
+// --- Output Sink ---
+// A stream buffer that writes a file (or stdout) in large, page-aligned
+// chunks. Output is collected in the stream's put area, so small writes such
+// as header fields are plain stores; a write larger than the buffer is handed
+// to the kernel together with the pending bytes in a single writev() instead
+// of being copied. Optionally the file is opened with O_DIRECT to bypass the
+// page cache, and on Linux the chunks can be written through io_uring, which
+// fills one buffer while the previous one is still being written.
+class OutputSink : public std::streambuf {
+public:
+    OutputSink();
+    ~OutputSink() override;
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+
+    // Creates (or truncates) `path`; "-" writes to stdout. Options the file
+    // does not support (O_DIRECT on some file systems, io_uring on pipes or
+    // older kernels) fall back to plain writes.
+    bool open(const std::string& path, const OutputOptions& options);
+
+    // Writes out everything still buffered and closes the file. Returns false
+    // if any write failed.
+    bool close();
+
+protected:
+    int_type overflow(int_type c) override;
+    std::streamsize xsputn(const char* data, std::streamsize count) override;
+    int sync() override;
+
+private:
+    struct Buffer;
+    class Uring;
+
+    bool flush(bool final);
+    bool writeAll(const char* data, size_t size);
+    bool writeVectored(const char* first, size_t firstSize, const char* second, size_t secondSize);
+    bool waitFor(int index);
+    bool disableDirect();
+    void resetPutArea(size_t keep);
+
+    int fd = -1;
+    bool ownsFd = false;
+    // Whether the output is a pipe or terminal, where a reader may be
+    // waiting: only then does a stream flush write partial buffers.
+    bool streaming = false;
+    bool direct = false;
+    bool failed = false;
+    uint64_t fileOffset = 0;
+    std::unique_ptr<Buffer[]> buffers;
+    int current = 0;
+    std::unique_ptr<Uring> uring;
+};
+
+#endif // OUTPUT_SINK_H